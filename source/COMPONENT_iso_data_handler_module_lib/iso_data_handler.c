@@ -29,13 +29,16 @@
  */
 
 
+#include <stdatomic.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 
+#include "wiced_bt_dev.h"
 #include "wiced_bt_isoc.h"
 #include "wiced_bt_trace.h"
-#include "wiced_memory.h"
+#include "wiced_timer.h"
 
 #include "iso_data_handler.h"
 
@@ -62,11 +65,589 @@
 
 #define ISO_PKT_DATA_LOAD_LENGTH_MASK 0x3FFF
 #define ISO_PKT_SDU_LENGTH_MASK 0x0FFF
+#define ISO_PKT_STATUS_FLAG_MASK 3
+#define ISO_PKT_STATUS_FLAG_OFFSET 14
 
-wiced_bt_buffer_t *g_cis_iso_pool = NULL;
+#define ISO_DHM_MAX_STREAMS 4
+
+// one bit per 12 bit connection handle, set while the CIS is connected or the BIS exists
+#define ISO_DHM_HANDLE_MASK 0x0FFF
+#define ISO_DHM_HANDLE_WORDS ((ISO_DHM_HANDLE_MASK + 1) / 32)
+
+// jitter buffer slots per handle, indexed by PSN % ISO_DHM_JB_SLOTS, depth must stay below it
+#define ISO_DHM_JB_SLOTS 8
+// per-handle RX consumers, slot = handle % ISO_DHM_RX_DEMUX_SLOTS; power of two
+#define ISO_DHM_RX_DEMUX_SLOTS 8
+
+// a PSN jump larger than this resynchronizes the jitter buffer instead of reporting every PSN lost
+#define ISO_DHM_JB_RESYNC_GAP 64
+
+// send times kept per handle for the latency histogram, packets in flight beyond it are not timed
+#define ISO_DHM_LAT_SLOTS 16
+
+// btsnoop file format, H4 (HCI UART) datalink
+#define ISO_DHM_BTSNOOP_VERSION 1
+#define ISO_DHM_BTSNOOP_DATALINK_H4 1002
+#define ISO_DHM_BTSNOOP_FLAG_RECEIVED 1
+#define ISO_DHM_BTSNOOP_EPOCH_DELTA_US 0x00DCDDB30F2F8000ull    // btsnoop counts from year 0, not 1970
+#define ISO_DHM_BTSNOOP_RECORD_HDR_SIZE 24
+#define ISO_DHM_H4_ISO_DATA 0x05
+
+// multiplexed SDU: frame count, then a channel table entry (channel << 12 | frame length) per frame, then the frames
+#define ISO_DHM_MUX_HDR_SIZE 1
+#define ISO_DHM_MUX_ENTRY_SIZE 2
+#define ISO_DHM_MUX_CHANNEL_OFFSET 12
+#define ISO_DHM_MUX_FRAME_LEN_MASK 0x0FFF
+
+#ifdef ISO_DHM_SHM_DATA_PATH
+#if ISO_DHM_SHM_RING_SLOTS & (ISO_DHM_SHM_RING_SLOTS - 1)
+#error "ISO_DHM_SHM_RING_SLOTS must be a power of two"
+#endif
+// the rings must be placed where the controller can reach them, e.g. CY_SECTION(".cy_sharedmem")
+#ifndef ISO_DHM_SHM_SECTION
+#define ISO_DHM_SHM_SECTION
+#endif
+#endif
+
+// HCI LE Read Buffer Size [v2], reports the controller's ISO data buffers
+#define ISO_DHM_HCI_LE_READ_BUFFER_SIZE_V2_OPCODE 0x2060
+#define ISO_DHM_READ_BUFFER_SIZE_V2_RSP_LEN 7
+
+// used until (or if) the controller reports its ISO data buffers
+#define ISO_DHM_DEFAULT_ISO_DATA_PACKET_LEN 550
+#define ISO_DHM_DEFAULT_NUM_ISO_DATA_PACKETS 6
+
+/*
+ * Every pool buffer starts with an owner tag so a free can be charged back
+ * to the handle's reserved quota or to the shared overflow region.
+ */
+#define ISO_DHM_BUF_TAG_SIZE 4
+#define ISO_DHM_BUF_HEADROOM (ISO_DHM_BUF_TAG_SIZE + ISO_LOAD_HEADER_SIZE_WITH_TS + ISO_DATA_HEADER_SIZE)
+
+#define ISO_DHM_BUF_OWNER_SHARED 0
+#define ISO_DHM_BUF_OWNER_RESERVED 1
+
+/*
+ * SDU buffers come from a static slab sized at compile time; the headroom
+ * in front of the SDU is part of every slot so headers are written in place.
+ * Slots are rounded up to 4 bytes to keep the tag and payload aligned.
+ */
+#define ISO_DHM_SLAB_SLOT_SIZE (((ISO_DHM_BUF_HEADROOM + ISO_DHM_SLAB_SDU_SIZE) + 3) & ~3)
+#define ISO_DHM_SLAB_EMPTY 0xFF
+
+#if (ISO_DHM_SLAB_BUF_COUNT < 1) || (ISO_DHM_SLAB_BUF_COUNT >= ISO_DHM_SLAB_EMPTY)
+#error "ISO_DHM_SLAB_BUF_COUNT must be 1..254"
+#endif
+#if ISO_DHM_SLAB_SDU_SIZE > ISO_PKT_SDU_LENGTH_MASK
+#error "ISO_DHM_SLAB_SDU_SIZE larger than the largest ISO SDU"
+#endif
+
+typedef struct
+{
+    uint16_t conn_handle;
+    uint8_t owner;
+    atomic_uint_least8_t refs;              // references held, see iso_dhm_ref_data_buffer
+} iso_dhm_buf_tag_t;
+
+/* Per connection handle state */
+typedef struct
+{
+    wiced_bool_t in_use;
+    uint16_t conn_handle;
+
+    /* buffer quota, reserved_bufs are only ever handed to this handle. The
+     * in-use counts move in whichever task allocates or frees the buffer. */
+    uint8_t reserved_bufs;
+    atomic_uint_least8_t reserved_in_use;
+    atomic_uint_least8_t shared_in_use;
+    uint32_t alloc_failures;
+
+    /* Inbound SDU reassembly, p_buf is a pool buffer holding the SDU so far */
+    struct
+    {
+        uint8_t *p_buf;
+        uint16_t len;
+        uint16_t sdu_len;
+        uint16_t psn;
+        uint32_t ts;
+        uint8_t ts_valid;
+        uint8_t packet_status;
+        wiced_bool_t next_psn_valid;
+        uint16_t next_psn;                  // PSN expected next, to spot skipped intervals on arrival
+    } rx;
+
+    /* TX time base, the SDU with PSN psn is due at ts; later PSNs follow every sdu_interval us */
+    struct
+    {
+        wiced_bool_t valid;
+        uint16_t psn;
+        uint32_t ts;
+        uint32_t sdu_interval;
+    } tx;
+
+    /* Controller credits held by this handle, and how long it waited for more */
+    struct
+    {
+        uint16_t in_flight;                 // ISO data packets not yet completed
+        uint16_t wanted;                    // credits waited for, 0 when not starved
+        uint64_t starved_since;
+        uint32_t starvations;
+        uint64_t starved_us;
+    } credit;
+
+    /* Optional PSN ordered jitter buffer, SDUs are released depth ISO intervals after arrival */
+    struct
+    {
+        wiced_bool_t enabled;
+        wiced_bool_t started;
+        uint8_t depth;
+        uint16_t next_psn;                  // oldest PSN not yet released
+        iso_dhm_lost_psn_cb_t lost_cb;
+        struct
+        {
+            wiced_bool_t valid;
+            uint8_t *p_buf;                 // pool buffer, NULL for an empty SDU
+            iso_dhm_rx_meta_t meta;
+        } slot[ISO_DHM_JB_SLOTS];
+        uint32_t lost;
+        uint32_t late;
+        uint32_t overflow;
+    } jb;
+
+    /* SDUs carry several channels' frames, see iso_dhm_mux_pack */
+    wiced_bool_t mux;
+    uint32_t mux_errors;
+
+    /* SDUs are sent through the shared memory TX ring, see iso_dhm_shm_enable */
+    wiced_bool_t shm;
+
+    struct
+    {
+        uint32_t tx_sdus;
+        uint32_t tx_write_failures;
+        uint32_t tx_completed;
+        uint32_t rx_packets;
+        uint32_t rx_zero_len;
+        uint32_t oversize;
+        uint32_t rx_malformed;
+        uint32_t rx_valid;
+        uint32_t rx_possibly_invalid;
+        uint32_t rx_lost;
+        uint32_t rx_missing;
+    } cnt;
+
+    /*
+     * Send times of the packets in flight, oldest at head. Once the ring is
+     * full further packets are only counted in untimed, and nothing is
+     * recorded again until those completed, so completions stay in order.
+     */
+    struct
+    {
+        uint32_t sent_us[ISO_DHM_LAT_SLOTS];
+        uint8_t head;
+        uint8_t count;
+        uint16_t untimed;
+        iso_dhm_latency_hist_t hist;
+    } lat;
+} iso_dhm_stream_t;
+
+/*
+ * Free slots form a stack linked through g_slab_next. The head word holds the
+ * top slot index in bits 0-7 and a generation count above it, bumped on every
+ * pop and push, so a compare-and-swap can not succeed on a stale head (ABA).
+ */
+static uint32_t g_slab_mem[ISO_DHM_SLAB_BUF_COUNT][ISO_DHM_SLAB_SLOT_SIZE / 4];
+static uint8_t g_slab_next[ISO_DHM_SLAB_BUF_COUNT];
+static atomic_uint_least32_t g_slab_head = ISO_DHM_SLAB_EMPTY;
+static atomic_uint_least32_t g_slab_live;
+static atomic_uint_least32_t g_slab_peak;
+static atomic_uint_least32_t g_slab_failed;
+static wiced_bool_t g_slab_ready;
 static iso_dhm_num_complete_evt_cb_t g_num_complete_cb;
+static iso_dhm_credits_available_cb_t g_credits_cb;
 static iso_dhm_rx_evt_cb_t g_rx_data_cb;
+static iso_dhm_rx_evt_v2_cb_t g_rx_data_v2_cb;
+static iso_dhm_channel_rx_cb_t g_channel_cbs[ISO_DHM_MUX_MAX_CHANNELS];
+static iso_dhm_lost_psn_cb_t g_conceal_cb;
+static struct
+{
+    uint16_t conn_handle;
+    iso_dhm_handle_rx_cb_t cb;              // NULL while the slot is free
+    void *p_ctx;
+} g_rx_demux[ISO_DHM_RX_DEMUX_SLOTS];
+static const wiced_bt_cfg_isoc_t *g_p_isoc_cfg;
+static iso_dhm_buffer_info_t g_buf_info = {
+    .iso_data_packet_len = ISO_DHM_DEFAULT_ISO_DATA_PACKET_LEN,
+    .total_num_iso_data_packets = ISO_DHM_DEFAULT_NUM_ISO_DATA_PACKETS,
+};
+static iso_dhm_stream_t g_streams[ISO_DHM_MAX_STREAMS];
+static iso_dhm_stream_t *g_p_last_stream;  // last handle looked up, usually the only one
+static uint32_t g_valid_handles[ISO_DHM_HANDLE_WORDS];
+static uint8_t g_rx_reassembly_count;   // number of handles holding a partial SDU
+static uint8_t g_jb_count;              // number of handles with a jitter buffer
+static uint8_t g_mux_count;             // number of handles receiving multiplexed SDUs
+static uint8_t g_rx_demux_count;        // number of handles bound to their own RX callback
+static uint8_t g_reserved_bufs_total;   // sum of all handles' reserved_bufs
+static atomic_uint_least8_t g_shared_in_use; // buffers taken from the shared overflow region
+static uint32_t g_shared_alloc_failures; // failures for buffers not bound to a handle
+static uint16_t g_credits;              // controller ISO data packets free for sending
+static uint8_t g_credit_waiters;        // handles waiting for credits
+
+#ifdef ISO_DHM_CAPTURE
+/*
+ * Packets are kept as they are, with the time they crossed the data handler;
+ * they are only turned into btsnoop records when dumped. The ring overwrites
+ * the oldest packet once full.
+ */
+static struct
+{
+    wiced_bool_t enabled;
+    uint32_t next;                          // total packets captured, the slot written next is next % SLOTS
+    struct
+    {
+        uint64_t ts_us;
+        uint16_t len;                       // length on the wire, data holds at most SNAPLEN of it
+        uint8_t received;
+        uint8_t data[ISO_DHM_CAPTURE_SNAPLEN];
+    } slot[ISO_DHM_CAPTURE_SLOTS];
+} g_capture;
+
+CY_SECTION_RAMFUNC_BEGIN
+static void iso_dhm_capture(const uint8_t *p_pkt, uint32_t len, uint8_t received)
+{
+    uint32_t idx;
+
+    if (!g_capture.enabled) { return; }
+
+    idx = g_capture.next++ % ISO_DHM_CAPTURE_SLOTS;
+    g_capture.slot[idx].ts_us = clock_SystemTimeMicroseconds64();
+    g_capture.slot[idx].len = (uint16_t)len;
+    g_capture.slot[idx].received = received;
+    memcpy(g_capture.slot[idx].data, p_pkt, (len < ISO_DHM_CAPTURE_SNAPLEN) ? len : ISO_DHM_CAPTURE_SNAPLEN);
+}
+CY_SECTION_RAMFUNC_END
+#endif
+
+#ifdef ISO_DHM_SHM_DATA_PATH
+/*
+ * The host produces into tx and consumes rx. A TX slot is reused only after
+ * iso_dhm_shm_poll reported it completed (tx_done), not as soon as the
+ * controller moved tx.tail past it, so the slot still names its handle.
+ */
+ISO_DHM_SHM_SECTION static iso_dhm_shm_ring_t g_shm_tx;
+ISO_DHM_SHM_SECTION static iso_dhm_shm_ring_t g_shm_rx;
+static uint32_t g_shm_tx_done;
+
+static uint16_t iso_dhm_shm_free(void)
+{
+    return (uint16_t)(ISO_DHM_SHM_RING_SLOTS - (g_shm_tx.head - g_shm_tx_done));
+}
+#endif
+
+/* Every HCI ISO data packet goes to the controller through here */
+CY_SECTION_RAMFUNC_BEGIN
+static wiced_bool_t iso_dhm_write_to_lower(uint8_t *p_pkt, uint32_t len)
+{
+#ifdef ISO_DHM_CAPTURE
+    iso_dhm_capture(p_pkt, len, 0);
+#endif
+    return wiced_ble_isoc_write_data_to_lower(p_pkt, len);
+}
+CY_SECTION_RAMFUNC_END
+
+static iso_dhm_stream_t *iso_dhm_get_stream(uint16_t conn_handle, wiced_bool_t create)
+{
+    iso_dhm_stream_t *p_free = NULL;
+    int i;
+
+    if (g_p_last_stream && g_p_last_stream->in_use && (g_p_last_stream->conn_handle == conn_handle)) { return g_p_last_stream; }
+
+    for (i = 0; i < ISO_DHM_MAX_STREAMS; i++)
+    {
+        if (g_streams[i].in_use)
+        {
+            if (g_streams[i].conn_handle == conn_handle) { return g_p_last_stream = &g_streams[i]; }
+        }
+        else if (!p_free)
+        {
+            p_free = &g_streams[i];
+        }
+    }
+
+    if (!create || !p_free) { return NULL; }
+
+    memset(p_free, 0, sizeof(*p_free));
+    p_free->in_use = WICED_TRUE;
+    p_free->conn_handle = conn_handle;
+    return g_p_last_stream = p_free;
+}
+
+static void iso_dhm_rx_reassembly_abort(iso_dhm_stream_t *p_stream)
+{
+    if (p_stream->rx.p_buf)
+    {
+        iso_dhm_free_data_buffer(p_stream->rx.p_buf);
+        p_stream->rx.p_buf = NULL;
+        g_rx_reassembly_count--;
+    }
+    p_stream->rx.len = 0;
+}
+
+/* Splits a multiplexed SDU into its frames, nothing is delivered unless the whole channel table checks out */
+static void iso_dhm_mux_deliver(iso_dhm_stream_t *p_stream, const iso_dhm_rx_meta_t *p_meta, uint8_t *p_data)
+{
+    uint8_t *p_table = p_data + ISO_DHM_MUX_HDR_SIZE;
+    uint8_t *p_frame;
+    uint32_t total;
+    uint16_t entry;
+    uint16_t len;
+    uint8_t channel;
+    uint8_t num_frames;
+    uint8_t i;
+
+    // lost or empty SDUs carry no frames
+    if (!p_meta->sdu_len) { return; }
+
+    num_frames = p_data[0];
+    total = ISO_DHM_MUX_HDR_SIZE + (uint32_t)num_frames * ISO_DHM_MUX_ENTRY_SIZE;
+    if (!num_frames || (num_frames > ISO_DHM_MUX_MAX_FRAMES) || (total > p_meta->sdu_len))
+    {
+        p_stream->mux_errors++;
+        return;
+    }
+
+    for (i = 0; i < num_frames; i++)
+    {
+        STREAM_TO_UINT16(entry, p_table);
+        total += entry & ISO_DHM_MUX_FRAME_LEN_MASK;
+    }
+    if (total != p_meta->sdu_len)
+    {
+        p_stream->mux_errors++;
+        return;
+    }
+
+    p_table = p_data + ISO_DHM_MUX_HDR_SIZE;
+    p_frame = p_table + num_frames * ISO_DHM_MUX_ENTRY_SIZE;
+    for (i = 0; i < num_frames; i++)
+    {
+        STREAM_TO_UINT16(entry, p_table);
+        channel = entry >> ISO_DHM_MUX_CHANNEL_OFFSET;
+        len = entry & ISO_DHM_MUX_FRAME_LEN_MASK;
+        if (g_channel_cbs[channel]) { g_channel_cbs[channel](p_meta, channel, p_frame, len); }
+        p_frame += len;
+    }
+}
+
+static void iso_dhm_deliver_rx(iso_dhm_rx_meta_t *p_meta, uint8_t *p_data)
+{
+    iso_dhm_stream_t *p_stream;
+    uint8_t slot;
+
+    // multiplexed handles go to the channel callbacks instead
+    if (g_mux_count && ((p_stream = iso_dhm_get_stream(p_meta->conn_handle, WICED_FALSE)) != NULL) && p_stream->mux)
+    {
+        iso_dhm_mux_deliver(p_stream, p_meta, p_data);
+        return;
+    }
+
+    // and handles with a consumer of their own to it
+    if (g_rx_demux_count)
+    {
+        slot = p_meta->conn_handle & (ISO_DHM_RX_DEMUX_SLOTS - 1);
+        if (g_rx_demux[slot].cb && (g_rx_demux[slot].conn_handle == p_meta->conn_handle))
+        {
+            g_rx_demux[slot].cb(g_rx_demux[slot].p_ctx, p_meta, p_data);
+            return;
+        }
+    }
+
+    if (g_rx_data_v2_cb) { g_rx_data_v2_cb(p_meta, p_data); }
+
+    // the original callback never sees empty SDUs
+    if (g_rx_data_cb && p_meta->sdu_len) { g_rx_data_cb(p_meta->conn_handle, p_data, p_meta->sdu_len); }
+}
+
+/* Releases the slot of jb.next_psn (or reports it lost) and advances next_psn */
+static void iso_dhm_jb_release_next(iso_dhm_stream_t *p_stream, wiced_bool_t deliver)
+{
+    uint8_t idx = p_stream->jb.next_psn % ISO_DHM_JB_SLOTS;
+
+    if (p_stream->jb.slot[idx].valid)
+    {
+        if (deliver)
+        {
+            if (p_stream->jb.slot[idx].meta.packet_status == ISO_DHM_PKT_STATUS_LOST)
+            {
+                p_stream->jb.lost++;
+                if (p_stream->jb.lost_cb) { p_stream->jb.lost_cb(p_stream->conn_handle, p_stream->jb.next_psn); }
+            }
+            iso_dhm_deliver_rx(&p_stream->jb.slot[idx].meta, p_stream->jb.slot[idx].p_buf);
+        }
+        if (p_stream->jb.slot[idx].p_buf) { iso_dhm_free_data_buffer(p_stream->jb.slot[idx].p_buf); }
+        p_stream->jb.slot[idx].p_buf = NULL;
+        p_stream->jb.slot[idx].valid = WICED_FALSE;
+    }
+    else if (deliver)
+    {
+        p_stream->jb.lost++;
+        if (p_stream->jb.lost_cb) { p_stream->jb.lost_cb(p_stream->conn_handle, p_stream->jb.next_psn); }
+    }
+
+    p_stream->jb.next_psn++;
+}
+
+/* Drops (or delivers, in PSN order) everything held and restarts on the next SDU */
+static void iso_dhm_jb_flush(iso_dhm_stream_t *p_stream, wiced_bool_t deliver)
+{
+    uint8_t i, count = 0;
+
+    // gaps up to the newest held SDU are losses, those after it are not known yet
+    for (i = 0; i < ISO_DHM_JB_SLOTS; i++)
+    {
+        if (p_stream->jb.slot[(uint16_t)(p_stream->jb.next_psn + i) % ISO_DHM_JB_SLOTS].valid) { count = i + 1; }
+    }
+    while (count--) { iso_dhm_jb_release_next(p_stream, deliver); }
+
+    p_stream->jb.started = WICED_FALSE;
+}
+
+/*
+ * Orders SDUs by PSN. An SDU with PSN p releases every PSN up to p - depth;
+ * PSNs with nothing received are reported through lost_cb. p_pool_buf, if
+ * not NULL, is a pool buffer holding p_data that the jitter buffer takes
+ * over; otherwise the payload is copied into a buffer from the handle's
+ * quota.
+ */
+static void iso_dhm_jb_insert(iso_dhm_stream_t *p_stream, iso_dhm_rx_meta_t *p_meta, uint8_t *p_data, uint8_t *p_pool_buf)
+{
+    uint16_t psn = p_meta->psn;
+    uint8_t idx = psn % ISO_DHM_JB_SLOTS;
+    int16_t offset = (int16_t)(psn - p_stream->jb.next_psn);
+
+    if (!p_stream->jb.started || (offset > ISO_DHM_JB_RESYNC_GAP) || (offset < -ISO_DHM_JB_RESYNC_GAP))
+    {
+        if (p_stream->jb.started) { iso_dhm_jb_flush(p_stream, WICED_TRUE); }
+        p_stream->jb.started = WICED_TRUE;
+        p_stream->jb.next_psn = psn;
+        offset = 0;
+    }
+
+    if (offset < 0)
+    {
+        // already released or reported lost
+        p_stream->jb.late++;
+        if (p_pool_buf) { iso_dhm_free_data_buffer(p_pool_buf); }
+        return;
+    }
+
+    // in order with no added delay, nothing to hold
+    if ((psn == p_stream->jb.next_psn) && !p_stream->jb.depth)
+    {
+        if (p_meta->packet_status == ISO_DHM_PKT_STATUS_LOST)
+        {
+            p_stream->jb.lost++;
+            if (p_stream->jb.lost_cb) { p_stream->jb.lost_cb(p_stream->conn_handle, psn); }
+        }
+        iso_dhm_deliver_rx(p_meta, p_data);
+        if (p_pool_buf) { iso_dhm_free_data_buffer(p_pool_buf); }
+        p_stream->jb.next_psn++;
+        return;
+    }
+
+    // make room: psn must be within ISO_DHM_JB_SLOTS of next_psn
+    while ((uint16_t)(psn - p_stream->jb.next_psn) >= ISO_DHM_JB_SLOTS)
+    {
+        iso_dhm_jb_release_next(p_stream, WICED_TRUE);
+    }
+
+    if (p_stream->jb.slot[idx].valid)
+    {
+        // duplicate PSN
+        p_stream->jb.late++;
+        if (p_pool_buf) { iso_dhm_free_data_buffer(p_pool_buf); }
+        return;
+    }
+
+    if (!p_pool_buf && p_meta->sdu_len)
+    {
+        // the SDU is copied into a slab slot
+        if (p_meta->sdu_len > ISO_DHM_SLAB_SDU_SIZE)
+        {
+            p_stream->cnt.oversize++;
+            return;
+        }
+        if ((p_pool_buf = iso_dhm_get_data_buffer_for_handle(p_stream->conn_handle)) == NULL)
+        {
+            p_stream->jb.overflow++;
+            return;
+        }
+        memcpy(p_pool_buf, p_data, p_meta->sdu_len);
+    }
+
+    p_stream->jb.slot[idx].valid = WICED_TRUE;
+    p_stream->jb.slot[idx].p_buf = p_pool_buf;
+    p_stream->jb.slot[idx].meta = *p_meta;
+
+    while ((int16_t)(psn - p_stream->jb.next_psn) >= p_stream->jb.depth)
+    {
+        iso_dhm_jb_release_next(p_stream, WICED_TRUE);
+    }
+}
+
+/*
+ * Counts the SDU's Packet_Status_Flag and, on arrival rather than after the
+ * jitter buffer, reports every interval without usable data to the
+ * concealment hook: the SDU itself if it is lost and any PSN skipped before it.
+ */
+static void iso_dhm_rx_status(iso_dhm_stream_t *p_stream, const iso_dhm_rx_meta_t *p_meta)
+{
+    int16_t gap = 0;
+
+    if (p_meta->packet_status == ISO_DHM_PKT_STATUS_VALID) { p_stream->cnt.rx_valid++; }
+    else if (p_meta->packet_status == ISO_DHM_PKT_STATUS_LOST) { p_stream->cnt.rx_lost++; }
+    else { p_stream->cnt.rx_possibly_invalid++; }
+
+    if (p_stream->rx.next_psn_valid)
+    {
+        gap = (int16_t)(p_meta->psn - p_stream->rx.next_psn);
+
+        // a jump this large either way is a restart, not loss
+        if ((gap > ISO_DHM_JB_RESYNC_GAP) || (gap < -ISO_DHM_JB_RESYNC_GAP)) { gap = 0; }
+
+        // late or duplicate, the intervals around it were already accounted for
+        if (gap < 0) { return; }
+        p_stream->cnt.rx_missing += gap;
+    }
+
+    if (g_conceal_cb)
+    {
+        for (; gap > 0; gap--) { g_conceal_cb(p_meta->conn_handle, (uint16_t)(p_meta->psn - gap)); }
+        if (p_meta->packet_status == ISO_DHM_PKT_STATUS_LOST) { g_conceal_cb(p_meta->conn_handle, p_meta->psn); }
+    }
+
+    p_stream->rx.next_psn = p_meta->psn + 1;
+    p_stream->rx.next_psn_valid = WICED_TRUE;
+}
+
+/* Hands a complete SDU to the jitter buffer or straight to the RX callbacks */
+static void iso_dhm_rx_sdu(iso_dhm_stream_t *p_stream, iso_dhm_rx_meta_t *p_meta, uint8_t *p_data, uint8_t *p_pool_buf)
+{
+    if (p_stream)
+    {
+        if (!p_meta->sdu_len) { p_stream->cnt.rx_zero_len++; }
+        iso_dhm_rx_status(p_stream, p_meta);
+    }
+
+    if (p_stream && p_stream->jb.enabled)
+    {
+        iso_dhm_jb_insert(p_stream, p_meta, p_data, p_pool_buf);
+        return;
+    }
 
+    iso_dhm_deliver_rx(p_meta, p_data);
+    if (p_pool_buf) { iso_dhm_free_data_buffer(p_pool_buf); }
+}
 
 void iso_dhm_process_rx_data(uint8_t *p_data, uint32_t length)
 {
@@ -76,120 +657,1045 @@ void iso_dhm_process_rx_data(uint8_t *p_data, uint32_t length)
     uint16_t pb_flag = 0;
     uint16_t psn = 0;
     uint16_t sdu_len = 0;
+    uint16_t packet_status = 0;
     uint32_t ts = 0;
+    iso_dhm_stream_t *p_stream;
+    iso_dhm_rx_meta_t meta;
+    uint8_t *p_buf;
+
+    if (!length) { WICED_BT_TRACE("dhm rx data len = 0 "); return; }
+
+#ifdef ISO_DHM_CAPTURE
+    iso_dhm_capture(p_data, length, 1);
+#endif
+
+    STREAM_TO_UINT16(handle_and_flags, p_data);
+    STREAM_TO_UINT16(data_load_length, p_data);
+
+    pb_flag = (handle_and_flags & (ISO_PKT_PB_FLAG_MASK << ISO_PKT_PB_FLAG_OFFSET)) >> ISO_PKT_PB_FLAG_OFFSET;
+    ts_flag = (handle_and_flags & (ISO_PKT_TS_FLAG_MASK << ISO_PKT_TS_FLAG_OFFSET)) >> ISO_PKT_TS_FLAG_OFFSET;
+
+    handle_and_flags &= ~(ISO_PKT_PB_FLAG_MASK << ISO_PKT_PB_FLAG_OFFSET);
+    handle_and_flags &= ~(ISO_PKT_TS_FLAG_MASK << ISO_PKT_TS_FLAG_OFFSET);
+    handle_and_flags &= ~(ISO_PKT_RESERVED_FLAG_MASK << ISO_PKT_RESERVED_FLAG_OFFSET);
+
+    data_load_length &= ISO_PKT_DATA_LOAD_LENGTH_MASK;
+
+    if (length < (uint32_t)data_load_length + ISO_DATA_HEADER_SIZE)
+    {
+        WICED_BT_TRACE("dhm rx truncated pkt %d < %d", (int)length, data_load_length + ISO_DATA_HEADER_SIZE);
+        return;
+    }
+
+    // ISO_Data_Load header is only present in the first fragment or a complete SDU
+    if ((pb_flag == ISO_PKT_PB_FLAG_FIRST_FRAGMENT) || (pb_flag == ISO_PKT_PB_FLAG_COMPLETE))
+    {
+        uint16_t load_hdr_size = ts_flag ? ISO_LOAD_HEADER_SIZE_WITH_TS : ISO_LOAD_HEADER_SIZE_WITHOUT_TS;
+
+        if (data_load_length < load_hdr_size) { return; }
+
+        if (ts_flag) { STREAM_TO_UINT32(ts, p_data); }
+
+        STREAM_TO_UINT16(psn, p_data);
+        STREAM_TO_UINT16(sdu_len, p_data);
+
+        packet_status = (sdu_len >> ISO_PKT_STATUS_FLAG_OFFSET) & ISO_PKT_STATUS_FLAG_MASK;
+        sdu_len &= ISO_PKT_SDU_LENGTH_MASK;
+        data_load_length -= load_hdr_size;
+    }
+
+     //WICED_BT_TRACE("Recv isoc data size %d ", sdu_len);
+     //WICED_BT_TRACE_ARRAY(p_data, sdu_len, "ISO Data");
+     //WICED_BT_TRACE("TS %d PB flag %d psn %d ", ts, pb_flag, psn);
+
+    if (pb_flag == ISO_PKT_PB_FLAG_COMPLETE)
+    {
+        // A complete SDU ends any reassembly in progress on this handle
+        if ((p_stream = iso_dhm_get_stream(handle_and_flags, WICED_FALSE)) != NULL)
+        {
+            p_stream->cnt.rx_packets++;
+            if (g_rx_reassembly_count) { iso_dhm_rx_reassembly_abort(p_stream); }
+        }
+
+        // the header's sdu_len is all later copies go by, it must be in the packet and fit a buffer
+        if (sdu_len > data_load_length)
+        {
+            WICED_BT_TRACE("dhm rx sdu_len %d > data load %d", sdu_len, data_load_length);
+            if (p_stream) { p_stream->cnt.rx_malformed++; }
+            return;
+        }
+        if (sdu_len > g_buf_info.max_sdu_len)
+        {
+            WICED_BT_TRACE("dhm rx sdu_len %d too large", sdu_len);
+            if (p_stream) { p_stream->cnt.oversize++; }
+            return;
+        }
+
+        meta.conn_handle = handle_and_flags;
+        meta.psn = psn;
+        meta.ts = ts;
+        meta.ts_valid = ts_flag;
+        meta.packet_status = packet_status;
+        meta.sdu_len = sdu_len;
+        iso_dhm_rx_sdu(p_stream, &meta, p_data, NULL);
+        return;
+    }
+
+    if ((p_stream = iso_dhm_get_stream(handle_and_flags, pb_flag == ISO_PKT_PB_FLAG_FIRST_FRAGMENT)) == NULL)
+    {
+        WICED_BT_TRACE("dhm rx fragment %d dropped for handle 0x%x", pb_flag, handle_and_flags);
+        return;
+    }
+    p_stream->cnt.rx_packets++;
+
+    if (pb_flag == ISO_PKT_PB_FLAG_FIRST_FRAGMENT)
+    {
+        iso_dhm_rx_reassembly_abort(p_stream);
+
+        if (sdu_len > g_buf_info.max_sdu_len)
+        {
+            WICED_BT_TRACE("dhm rx sdu_len %d too large", sdu_len);
+            p_stream->cnt.oversize++;
+            return;
+        }
+        if ((p_stream->rx.p_buf = iso_dhm_get_data_buffer_for_handle(handle_and_flags)) == NULL)
+        {
+            WICED_BT_TRACE("dhm rx no reassembly buffer for sdu_len %d", sdu_len);
+            return;
+        }
+        g_rx_reassembly_count++;
+
+        p_stream->rx.sdu_len = sdu_len;
+        p_stream->rx.psn = psn;
+        p_stream->rx.ts = ts;
+        p_stream->rx.ts_valid = ts_flag;
+        p_stream->rx.packet_status = packet_status;
+    }
+    else if (!p_stream->rx.p_buf)
+    {
+        // continuation or last fragment without a first fragment
+        return;
+    }
+
+    if ((uint32_t)p_stream->rx.len + data_load_length > p_stream->rx.sdu_len)
+    {
+        WICED_BT_TRACE("dhm rx fragment overflows sdu_len %d", p_stream->rx.sdu_len);
+        iso_dhm_rx_reassembly_abort(p_stream);
+        return;
+    }
+
+    memcpy(p_stream->rx.p_buf + p_stream->rx.len, p_data, data_load_length);
+    p_stream->rx.len += data_load_length;
+
+    if (pb_flag != ISO_PKT_PB_FLAG_LAST_FRAGMENT) { return; }
+
+    if (p_stream->rx.len == p_stream->rx.sdu_len)
+    {
+        meta.conn_handle = handle_and_flags;
+        meta.psn = p_stream->rx.psn;
+        meta.ts = p_stream->rx.ts;
+        meta.ts_valid = p_stream->rx.ts_valid;
+        meta.packet_status = p_stream->rx.packet_status;
+        meta.sdu_len = p_stream->rx.len;
+
+        // the reassembly buffer moves on with the SDU
+        p_buf = p_stream->rx.p_buf;
+        p_stream->rx.p_buf = NULL;
+        p_stream->rx.len = 0;
+        g_rx_reassembly_count--;
+
+        iso_dhm_rx_sdu(p_stream, &meta, p_buf, p_buf);
+        return;
+    }
+
+    iso_dhm_rx_reassembly_abort(p_stream);
+}
+
+/* Records the send time of num packets just written to the controller */
+CY_SECTION_RAMFUNC_BEGIN
+static void iso_dhm_lat_sent(iso_dhm_stream_t *p_stream, uint16_t num)
+{
+    uint32_t now_us;
+
+    if (!p_stream || !num) { return; }
+
+    now_us = (uint32_t)clock_SystemTimeMicroseconds64();
+    for (; num; num--)
+    {
+        if (p_stream->lat.untimed || (p_stream->lat.count == ISO_DHM_LAT_SLOTS))
+        {
+            p_stream->lat.untimed++;
+            continue;
+        }
+        p_stream->lat.sent_us[(p_stream->lat.head + p_stream->lat.count) % ISO_DHM_LAT_SLOTS] = now_us;
+        p_stream->lat.count++;
+    }
+}
+CY_SECTION_RAMFUNC_END
+
+/* Adds the send-to-complete time of the num oldest packets in flight to the histogram */
+CY_SECTION_RAMFUNC_BEGIN
+static void iso_dhm_lat_completed(iso_dhm_stream_t *p_stream, uint16_t num)
+{
+    iso_dhm_latency_hist_t *p_hist = &p_stream->lat.hist;
+    uint32_t now_us;
+    uint32_t delta_us;
+    uint32_t v;
+    uint8_t bucket;
+
+    p_stream->cnt.tx_completed += num;
+    if (!p_stream->lat.count && !p_stream->lat.untimed) { return; }
+
+    now_us = (uint32_t)clock_SystemTimeMicroseconds64();
+
+    for (; num; num--)
+    {
+        if (!p_stream->lat.count)
+        {
+            if (!p_stream->lat.untimed) { break; }
+            p_stream->lat.untimed--;
+            p_hist->untimed++;
+            continue;
+        }
+
+        delta_us = now_us - p_stream->lat.sent_us[p_stream->lat.head];
+        p_stream->lat.head = (p_stream->lat.head + 1) % ISO_DHM_LAT_SLOTS;
+        p_stream->lat.count--;
+
+        // floor(log2(delta_us)), 0 us counts with 1 us
+        for (bucket = 0, v = delta_us >> 1; v && (bucket < ISO_DHM_LATENCY_BUCKETS - 1); v >>= 1) { bucket++; }
+        p_hist->bucket[bucket]++;
+        p_hist->total_us += delta_us;
+        if (delta_us > p_hist->max_us) { p_hist->max_us = delta_us; }
+    }
+}
+CY_SECTION_RAMFUNC_END
+
+/* Marks the handle starved, to be called back through g_credits_cb once num credits are free again */
+CY_SECTION_RAMFUNC_BEGIN
+static void iso_dhm_starve(iso_dhm_stream_t *p_stream, uint16_t num)
+{
+    if (!p_stream->credit.wanted)
+    {
+        p_stream->credit.starved_since = clock_SystemTimeMicroseconds64();
+        p_stream->credit.starvations++;
+        g_credit_waiters++;
+    }
+    p_stream->credit.wanted = num;
+}
+CY_SECTION_RAMFUNC_END
+
+/* Takes num controller credits for a send on p_stream's handle, or marks the handle starved */
+CY_SECTION_RAMFUNC_BEGIN
+static wiced_bool_t iso_dhm_take_credits(iso_dhm_stream_t *p_stream, uint16_t conn_handle, uint16_t num)
+{
+    if (g_credits >= num)
+    {
+        g_credits -= num;
+        if (p_stream) { p_stream->credit.in_flight += num; }
+        return WICED_TRUE;
+    }
+
+    if (!p_stream) { p_stream = iso_dhm_get_stream(conn_handle, WICED_TRUE); }
+    if (p_stream) { iso_dhm_starve(p_stream, num); }
+    return WICED_FALSE;
+}
+CY_SECTION_RAMFUNC_END
+
+CY_SECTION_RAMFUNC_BEGIN
+static void iso_dhm_return_credits(iso_dhm_stream_t *p_stream, uint16_t num)
+{
+    if (p_stream) { p_stream->credit.in_flight -= (num < p_stream->credit.in_flight) ? num : p_stream->credit.in_flight; }
+
+    // never more than the controller has, e.g. after a handle was removed with packets in flight
+    g_credits += num;
+    if (g_credits > g_buf_info.total_num_iso_data_packets) { g_credits = g_buf_info.total_num_iso_data_packets; }
+}
+CY_SECTION_RAMFUNC_END
+
+/* Ends the starvation of every handle whose wanted credits are free again */
+CY_SECTION_RAMFUNC_BEGIN
+static void iso_dhm_notify_credits(void)
+{
+    uint64_t now = clock_SystemTimeMicroseconds64();
+    int i;
+
+    for (i = 0; (i < ISO_DHM_MAX_STREAMS) && g_credit_waiters; i++)
+    {
+        iso_dhm_stream_t *p_stream = &g_streams[i];
+
+        uint16_t credits = g_credits;
+
+#ifdef ISO_DHM_SHM_DATA_PATH
+        if (p_stream->shm) { credits = iso_dhm_shm_free(); }
+#endif
+        if (!p_stream->in_use || !p_stream->credit.wanted || (credits < p_stream->credit.wanted)) { continue; }
+
+        p_stream->credit.starved_us += now - p_stream->credit.starved_since;
+        p_stream->credit.wanted = 0;
+        g_credit_waiters--;
+
+        if (g_credits_cb) { g_credits_cb(p_stream->conn_handle, credits); }
+    }
+}
+CY_SECTION_RAMFUNC_END
+
+#ifdef ISO_DHM_SHM_DATA_PATH
+/* Copies the SDU into the TX ring, the slot is all the framing the controller needs */
+CY_SECTION_RAMFUNC_BEGIN
+static wiced_bool_t iso_dhm_shm_send(iso_dhm_stream_t *p_stream, uint16_t psn, uint8_t ts_flag, uint32_t ts,
+                                     uint8_t *p_data_buf, uint32_t data_buf_len)
+{
+    iso_dhm_shm_slot_t *p_slot;
+
+    if (!iso_dhm_shm_free())
+    {
+        iso_dhm_starve(p_stream, 1);
+        iso_dhm_free_data_buffer(p_data_buf);
+        return WICED_FALSE;
+    }
+
+    p_slot = &g_shm_tx.slot[g_shm_tx.head & (ISO_DHM_SHM_RING_SLOTS - 1)];
+    p_slot->conn_handle = p_stream->conn_handle;
+    p_slot->psn = psn;
+    p_slot->ts = ts;
+    p_slot->ts_valid = ts_flag;
+    p_slot->packet_status = ISO_DHM_PKT_STATUS_VALID;
+    p_slot->sdu_len = (uint16_t)data_buf_len;
+    memcpy(p_slot->sdu, p_data_buf, data_buf_len);
+    iso_dhm_free_data_buffer(p_data_buf);
+
+    // the slot must be visible before the head that publishes it
+    atomic_thread_fence(memory_order_release);
+    g_shm_tx.head++;
+
+    iso_dhm_lat_sent(p_stream, 1);
+    return WICED_TRUE;
+}
+CY_SECTION_RAMFUNC_END
+#endif
+
+CY_SECTION_RAMFUNC_BEGIN
+wiced_bool_t iso_dhm_process_num_completed_pkts(uint8_t *p_buf)
+{
+    uint8_t num_handles, xx;
+    uint16_t handle;
+    uint16_t num_sent;
+    wiced_bool_t complete = WICED_TRUE;
+
+
+    STREAM_TO_UINT8(num_handles, p_buf);
+
+    for (xx = 0; xx < num_handles; xx++)
+    {
+        STREAM_TO_UINT16(handle, p_buf);
+        STREAM_TO_UINT16(num_sent, p_buf);
+
+        // WICED_BT_TRACE("[%s] handle 0x%x num_sent %d", __FUNCTION__, handle, num_sent);
+
+        //validate handle
+        handle &= ISO_DHM_HANDLE_MASK;
+        if (g_valid_handles[handle >> 5] & (1u << (handle & 0x1F)))
+        {
+            iso_dhm_stream_t *p_stream = iso_dhm_get_stream(handle, WICED_FALSE);
+
+            iso_dhm_return_credits(p_stream, num_sent);
+            if (p_stream) { iso_dhm_lat_completed(p_stream, num_sent); }
+
+            //callback to app to send more packets
+            if (g_num_complete_cb) {
+                    g_num_complete_cb(handle, num_sent);
+            }
+        }
+        else {
+            complete = WICED_FALSE;
+        }
+    }
+
+    if (g_credit_waiters) { iso_dhm_notify_credits(); }
+
+    return complete;
+}
+CY_SECTION_RAMFUNC_END
+
+CY_SECTION_RAMFUNC_BEGIN
+static uint8_t *iso_dhm_slab_alloc(void)
+{
+    uint_least32_t head = atomic_load_explicit(&g_slab_head, memory_order_acquire);
+    uint_least32_t live, peak;
+    uint8_t idx;
+
+    do
+    {
+        idx = head & 0xFF;
+        if (idx == ISO_DHM_SLAB_EMPTY)
+        {
+            atomic_fetch_add_explicit(&g_slab_failed, 1, memory_order_relaxed);
+            return NULL;
+        }
+    } while (!atomic_compare_exchange_weak_explicit(&g_slab_head, &head,
+                                                    ((head + 0x100) & ~0xFFu) | g_slab_next[idx],
+                                                    memory_order_acquire, memory_order_acquire));
+
+    live = atomic_fetch_add_explicit(&g_slab_live, 1, memory_order_relaxed) + 1;
+    peak = atomic_load_explicit(&g_slab_peak, memory_order_relaxed);
+    while ((live > peak) && !atomic_compare_exchange_weak_explicit(&g_slab_peak, &peak, live,
+                                                                  memory_order_relaxed, memory_order_relaxed))
+    {
+    }
+
+    return (uint8_t *)g_slab_mem[idx];
+}
+CY_SECTION_RAMFUNC_END
+
+CY_SECTION_RAMFUNC_BEGIN
+static void iso_dhm_slab_free(void *p_slot)
+{
+    uint8_t idx = (uint8_t)(((uint32_t *)p_slot - g_slab_mem[0]) / (ISO_DHM_SLAB_SLOT_SIZE / 4));
+    uint_least32_t head = atomic_load_explicit(&g_slab_head, memory_order_relaxed);
+
+    do
+    {
+        g_slab_next[idx] = head & 0xFF;
+    } while (!atomic_compare_exchange_weak_explicit(&g_slab_head, &head, ((head + 0x100) & ~0xFFu) | idx,
+                                                    memory_order_release, memory_order_relaxed));
+
+    atomic_fetch_sub_explicit(&g_slab_live, 1, memory_order_relaxed);
+}
+CY_SECTION_RAMFUNC_END
+
+/*
+ * Sets up the SDU slab once the ISO data buffer geometry is known. Buffers
+ * hold a whole SDU (max_sdu_size * channel_count) plus the owner tag and the
+ * HCI headers. Holding more SDUs per CIS than the controller has ISO data
+ * packets buys nothing, so max_buffers_per_cis is capped by the controller's
+ * total before it is multiplied by max_cis_conn. Both are then capped by
+ * what the slab was built with.
+ */
+static void iso_dhm_create_pool(void)
+{
+    uint32_t sdu_size = g_p_isoc_cfg->max_sdu_size * g_p_isoc_cfg->channel_count;
+    uint32_t buf_count = g_p_isoc_cfg->max_buffers_per_cis;
+    uint8_t i;
+
+    if (sdu_size > ISO_DHM_SLAB_SDU_SIZE)
+    {
+        WICED_BT_TRACE_CRIT("[%s] SDU size %d capped to ISO_DHM_SLAB_SDU_SIZE %d",
+                            __FUNCTION__, (int)sdu_size, ISO_DHM_SLAB_SDU_SIZE);
+        sdu_size = ISO_DHM_SLAB_SDU_SIZE;
+    }
+
+    if (buf_count > g_buf_info.total_num_iso_data_packets) { buf_count = g_buf_info.total_num_iso_data_packets; }
+    if (!buf_count) { buf_count = 1; }
+    if (g_p_isoc_cfg->max_cis_conn > 1) { buf_count *= g_p_isoc_cfg->max_cis_conn; }
+    if (buf_count > ISO_DHM_SLAB_BUF_COUNT) { buf_count = ISO_DHM_SLAB_BUF_COUNT; }
+
+    g_buf_info.max_sdu_len = sdu_size;
+
+    // Set up only once, allowing multiple calls to update callbacks
+    if (g_slab_ready) { return; }
+
+    g_buf_info.pool_buf_size = ISO_DHM_SLAB_SLOT_SIZE;
+    g_buf_info.pool_buf_count = buf_count;
+    g_credits = g_buf_info.total_num_iso_data_packets;
+
+    // only buf_count slots go on the free list, the rest of the slab stays unused
+    for (i = 0; i < buf_count; i++) { g_slab_next[i] = (i + 1u < buf_count) ? i + 1 : ISO_DHM_SLAB_EMPTY; }
+    atomic_store(&g_slab_head, 0);
+    g_slab_ready = WICED_TRUE;
+
+    WICED_BT_TRACE("[%s] SDU slab 0x%p size %d count %d",
+                   __FUNCTION__,
+                   g_slab_mem,
+                   (int)g_buf_info.pool_buf_size,
+                   g_buf_info.pool_buf_count);
+}
+
+/*
+ * p_param_buf is the raw Command Complete return parameters of LE Read Buffer
+ * Size [v2] (Core Vol 4 Part E 7.8.2): status, ACL packet length and count,
+ * ISO packet length and count. Nothing checks the layout for us, so a short
+ * response falls back to the defaults.
+ */
+static void iso_dhm_read_buffer_size_cb(wiced_bt_dev_vendor_specific_command_complete_params_t *p_params)
+{
+    uint8_t *p = p_params->p_param_buf;
+    uint8_t status;
+    uint16_t acl_data_packet_len;
+    uint8_t total_num_acl_data_packets;
+    uint16_t iso_data_packet_len;
+    uint8_t total_num_iso_data_packets;
+
+    if (p_params->param_len < ISO_DHM_READ_BUFFER_SIZE_V2_RSP_LEN)
+    {
+        WICED_BT_TRACE("[%s] short response %d, using defaults", __FUNCTION__, p_params->param_len);
+        iso_dhm_create_pool();
+        return;
+    }
+
+    STREAM_TO_UINT8(status, p);
+    STREAM_TO_UINT16(acl_data_packet_len, p);
+    STREAM_TO_UINT8(total_num_acl_data_packets, p);
+    STREAM_TO_UINT16(iso_data_packet_len, p);
+    STREAM_TO_UINT8(total_num_iso_data_packets, p);
+
+    (void)acl_data_packet_len;
+    (void)total_num_acl_data_packets;
+
+    WICED_BT_TRACE("[%s] status %d iso_data_packet_len %d total_num_iso_data_packets %d",
+                   __FUNCTION__,
+                   status,
+                   iso_data_packet_len,
+                   total_num_iso_data_packets);
+
+    // the v2 command reports 0 when the controller has no dedicated ISO buffers
+    if ((status == WICED_BT_SUCCESS) && (iso_data_packet_len > ISO_LOAD_HEADER_SIZE_WITH_TS) && total_num_iso_data_packets)
+    {
+        g_buf_info.iso_data_packet_len = iso_data_packet_len & ISO_PKT_DATA_LOAD_LENGTH_MASK;
+        g_buf_info.total_num_iso_data_packets = total_num_iso_data_packets;
+        g_buf_info.from_controller = WICED_TRUE;
+    }
+
+    iso_dhm_create_pool();
+}
+
+void iso_dhm_init(const wiced_bt_cfg_isoc_t *p_isoc_cfg,
+                  iso_dhm_num_complete_evt_cb_t num_complete_cb,
+                  iso_dhm_rx_evt_cb_t rx_data_cb)
+{
+    wiced_ble_isoc_register_data_cb(iso_dhm_process_rx_data, iso_dhm_process_num_completed_pkts);
+
+    g_p_isoc_cfg = p_isoc_cfg;
+    g_num_complete_cb = num_complete_cb;
+    g_rx_data_cb = rx_data_cb;
+
+#ifdef ISO_DHM_SHM_DATA_PATH
+    // both rings start empty, the controller finds them once a data path is set up
+    memset(&g_shm_tx, 0, sizeof(g_shm_tx));
+    memset(&g_shm_rx, 0, sizeof(g_shm_rx));
+    g_shm_tx_done = 0;
+#endif
+
+    // The pool is created once the controller reports its ISO data buffers.
+    // The stack has no API for LE Read Buffer Size [v2]. It is a standard
+    // command, but the vendor specific command path is the only way to send
+    // an arbitrary opcode and get its Command Complete back.
+    if (wiced_bt_dev_vendor_specific_command(ISO_DHM_HCI_LE_READ_BUFFER_SIZE_V2_OPCODE, 0, NULL,
+                                             iso_dhm_read_buffer_size_cb) != WICED_BT_PENDING)
+    {
+        WICED_BT_TRACE("[%s] LE Read Buffer Size v2 failed, using defaults", __FUNCTION__);
+        iso_dhm_create_pool();
+    }
+}
+
+void iso_dhm_register_rx_v2_cb(iso_dhm_rx_evt_v2_cb_t rx_data_v2_cb)
+{
+    g_rx_data_v2_cb = rx_data_v2_cb;
+}
+
+void iso_dhm_register_conceal_cb(iso_dhm_lost_psn_cb_t conceal_cb)
+{
+    g_conceal_cb = conceal_cb;
+}
+
+wiced_bool_t iso_dhm_register_handle_rx_cb(uint16_t conn_handle, iso_dhm_handle_rx_cb_t rx_cb, void *p_ctx)
+{
+    uint8_t slot;
+
+    conn_handle &= ISO_DHM_HANDLE_MASK;
+    slot = conn_handle & (ISO_DHM_RX_DEMUX_SLOTS - 1);
+
+    if (g_rx_demux[slot].cb && (g_rx_demux[slot].conn_handle != conn_handle))
+    {
+        // unbinding a handle that was never bound is not an error
+        if (!rx_cb) { return WICED_TRUE; }
+        WICED_BT_TRACE("[%s] slot of 0x%x taken by 0x%x", __FUNCTION__, conn_handle, g_rx_demux[slot].conn_handle);
+        return WICED_FALSE;
+    }
+
+    if (rx_cb && !g_rx_demux[slot].cb) { g_rx_demux_count++; }
+    if (!rx_cb && g_rx_demux[slot].cb) { g_rx_demux_count--; }
+    g_rx_demux[slot].conn_handle = conn_handle;
+    g_rx_demux[slot].cb = rx_cb;
+    g_rx_demux[slot].p_ctx = p_ctx;
+    return WICED_TRUE;
+}
+
+const iso_dhm_buffer_info_t *iso_dhm_get_buffer_info(void)
+{
+    return &g_buf_info;
+}
+
+/*
+ * Buffers are allocated and freed from both the application tasks and the
+ * BT stack thread, so a quota count is only ever moved with a CAS.
+ */
+CY_SECTION_RAMFUNC_BEGIN
+static wiced_bool_t iso_dhm_quota_take(atomic_uint_least8_t *p_in_use, uint8_t limit)
+{
+    uint_least8_t in_use = atomic_load_explicit(p_in_use, memory_order_relaxed);
+
+    do
+    {
+        if (in_use >= limit) { return WICED_FALSE; }
+    } while (!atomic_compare_exchange_weak_explicit(p_in_use, &in_use, in_use + 1,
+                                                    memory_order_relaxed, memory_order_relaxed));
+    return WICED_TRUE;
+}
+CY_SECTION_RAMFUNC_END
+
+CY_SECTION_RAMFUNC_BEGIN
+static void iso_dhm_quota_put(atomic_uint_least8_t *p_in_use)
+{
+    uint_least8_t in_use = atomic_load_explicit(p_in_use, memory_order_relaxed);
+
+    // the handle may have been removed, and its counts cleared, while the buffer was out
+    do
+    {
+        if (!in_use) { return; }
+    } while (!atomic_compare_exchange_weak_explicit(p_in_use, &in_use, in_use - 1,
+                                                    memory_order_relaxed, memory_order_relaxed));
+}
+CY_SECTION_RAMFUNC_END
+
+CY_SECTION_RAMFUNC_BEGIN
+static void iso_dhm_quota_release(iso_dhm_stream_t *p_stream, uint8_t owner)
+{
+    if (owner == ISO_DHM_BUF_OWNER_RESERVED)
+    {
+        if (p_stream) { iso_dhm_quota_put(&p_stream->reserved_in_use); }
+    }
+    else
+    {
+        iso_dhm_quota_put(&g_shared_in_use);
+        if (p_stream) { iso_dhm_quota_put(&p_stream->shared_in_use); }
+    }
+}
+CY_SECTION_RAMFUNC_END
+
+/*
+ * A handle first uses its reserved quota, then competes for the shared
+ * region (pool_buf_count - g_reserved_bufs_total). A stalled or bursting
+ * handle can therefore never take buffers reserved for another one.
+ */
+CY_SECTION_RAMFUNC_BEGIN
+static uint8_t *iso_dhm_alloc_buffer(iso_dhm_stream_t *p_stream, uint16_t conn_handle)
+{
+    uint8_t *p_buf = NULL;
+    iso_dhm_buf_tag_t *p_tag;
+    uint8_t owner;
+
+    if (p_stream && iso_dhm_quota_take(&p_stream->reserved_in_use, p_stream->reserved_bufs))
+    {
+        owner = ISO_DHM_BUF_OWNER_RESERVED;
+    }
+    else if (iso_dhm_quota_take(&g_shared_in_use,
+                                (uint8_t)(g_buf_info.pool_buf_count - g_reserved_bufs_total)))
+    {
+        owner = ISO_DHM_BUF_OWNER_SHARED;
+        if (p_stream) { atomic_fetch_add_explicit(&p_stream->shared_in_use, 1, memory_order_relaxed); }
+    }
+    else
+    {
+        goto fail;
+    }
+
+    // no slab until the controller has reported its ISO data buffers
+    if ((p_buf = iso_dhm_slab_alloc()) == NULL)
+    {
+        iso_dhm_quota_release(p_stream, owner);
+        goto fail;
+    }
+
+    p_tag = (iso_dhm_buf_tag_t *)p_buf;
+    p_tag->conn_handle = conn_handle;
+    p_tag->owner = owner;
+    atomic_init(&p_tag->refs, 1);
+
+    return p_buf + ISO_DHM_BUF_HEADROOM;
+
+fail:
+    if (p_stream) { p_stream->alloc_failures++; }
+    else { g_shared_alloc_failures++; }
+    return NULL;
+}
+CY_SECTION_RAMFUNC_END
+
+CY_SECTION_RAMFUNC_BEGIN
+uint8_t *iso_dhm_get_data_buffer(void)
+{
+    return iso_dhm_alloc_buffer(NULL, 0);
+}
+CY_SECTION_RAMFUNC_END
+
+CY_SECTION_RAMFUNC_BEGIN
+uint8_t *iso_dhm_get_data_buffer_for_handle(uint16_t conn_handle)
+{
+    return iso_dhm_alloc_buffer(iso_dhm_get_stream(conn_handle, WICED_FALSE), conn_handle);
+}
+CY_SECTION_RAMFUNC_END
+
+CY_SECTION_RAMFUNC_BEGIN
+void iso_dhm_free_data_buffer(uint8_t *p_buf)
+{
+    iso_dhm_buf_tag_t *p_tag = (iso_dhm_buf_tag_t *)(p_buf - ISO_DHM_BUF_HEADROOM);
+
+    // the senders of a fanout drop their references from different tasks
+    if (atomic_fetch_sub_explicit(&p_tag->refs, 1, memory_order_acq_rel) != 1)
+    {
+        return;
+    }
+
+    // shared buffers are charged to their handle too, even one with no reserved buffers
+    iso_dhm_quota_release(iso_dhm_get_stream(p_tag->conn_handle, WICED_FALSE), p_tag->owner);
+    iso_dhm_slab_free(p_tag);
+}
+CY_SECTION_RAMFUNC_END
+
+/* The caller holds a reference, so the count cannot drop to zero meanwhile */
+CY_SECTION_RAMFUNC_BEGIN
+static wiced_bool_t iso_dhm_buf_add_refs(iso_dhm_buf_tag_t *p_tag, uint8_t num)
+{
+    uint_least8_t refs = atomic_load_explicit(&p_tag->refs, memory_order_relaxed);
+
+    do
+    {
+        if ((uint32_t)refs + num > UINT8_MAX) { return WICED_FALSE; }
+    } while (!atomic_compare_exchange_weak_explicit(&p_tag->refs, &refs, refs + num,
+                                                    memory_order_relaxed, memory_order_relaxed));
+    return WICED_TRUE;
+}
+CY_SECTION_RAMFUNC_END
+
+wiced_bool_t iso_dhm_ref_data_buffer(uint8_t *p_buf)
+{
+    iso_dhm_buf_tag_t *p_tag = (iso_dhm_buf_tag_t *)(p_buf - ISO_DHM_BUF_HEADROOM);
+
+    return iso_dhm_buf_add_refs(p_tag, 1);
+}
+
+void iso_dhm_register_credits_cb(iso_dhm_credits_available_cb_t credits_cb)
+{
+    g_credits_cb = credits_cb;
+}
+
+CY_SECTION_RAMFUNC_BEGIN
+uint16_t iso_dhm_get_credits(void)
+{
+    return g_credits;
+}
+CY_SECTION_RAMFUNC_END
+
+CY_SECTION_RAMFUNC_BEGIN
+wiced_bool_t iso_dhm_has_credits(uint16_t conn_handle, uint16_t num)
+{
+#ifdef ISO_DHM_SHM_DATA_PATH
+    iso_dhm_stream_t *p_stream = iso_dhm_get_stream(conn_handle, WICED_FALSE);
+
+    // num counts HCI ISO data packets, at least as many as SDUs, and SDUs are what take slots
+    if (p_stream && p_stream->shm)
+    {
+        if (num > ISO_DHM_SHM_RING_SLOTS) { num = ISO_DHM_SHM_RING_SLOTS; }
+        if (iso_dhm_shm_free() >= num) { return WICED_TRUE; }
+        iso_dhm_starve(p_stream, num);
+        return WICED_FALSE;
+    }
+#endif
+    if (g_credits >= num) { return WICED_TRUE; }
+
+    // not taken, only arms the credits available callback
+    iso_dhm_take_credits(NULL, conn_handle, num);
+    return WICED_FALSE;
+}
+CY_SECTION_RAMFUNC_END
+
+void iso_dhm_set_handle_valid(uint16_t conn_handle, wiced_bool_t valid)
+{
+    conn_handle &= ISO_DHM_HANDLE_MASK;
+
+    if (valid) { g_valid_handles[conn_handle >> 5] |= (1u << (conn_handle & 0x1F)); }
+    else { g_valid_handles[conn_handle >> 5] &= ~(1u << (conn_handle & 0x1F)); }
+}
+
+void iso_dhm_get_slab_stats(iso_dhm_slab_stats_t *p_stats)
+{
+    p_stats->slot_size = ISO_DHM_SLAB_SLOT_SIZE;
+    p_stats->slot_count = g_buf_info.pool_buf_count;
+    p_stats->live = atomic_load(&g_slab_live);
+    p_stats->peak = atomic_load(&g_slab_peak);
+    p_stats->failed = atomic_load(&g_slab_failed);
+}
+
+wiced_bool_t iso_dhm_add_handle(uint16_t conn_handle, uint8_t reserved_bufs)
+{
+    iso_dhm_stream_t *p_stream = iso_dhm_get_stream(conn_handle, WICED_FALSE);
+    uint8_t current = p_stream ? p_stream->reserved_bufs : 0;
+
+    if ((uint32_t)g_reserved_bufs_total - current + reserved_bufs > g_buf_info.pool_buf_count)
+    {
+        WICED_BT_TRACE("[%s] handle 0x%x cannot reserve %d of %d bufs, %d already reserved",
+                       __FUNCTION__, conn_handle, reserved_bufs,
+                       g_buf_info.pool_buf_count, g_reserved_bufs_total - current);
+        return WICED_FALSE;
+    }
+
+    if (!p_stream && (p_stream = iso_dhm_get_stream(conn_handle, WICED_TRUE)) == NULL)
+    {
+        WICED_BT_TRACE("[%s] no free stream for handle 0x%x", __FUNCTION__, conn_handle);
+        return WICED_FALSE;
+    }
+
+    g_reserved_bufs_total = g_reserved_bufs_total - current + reserved_bufs;
+    p_stream->reserved_bufs = reserved_bufs;
+    return WICED_TRUE;
+}
+
+wiced_bool_t iso_dhm_get_handle_stats(uint16_t conn_handle, iso_dhm_handle_stats_t *p_stats)
+{
+    iso_dhm_stream_t *p_stream = iso_dhm_get_stream(conn_handle, WICED_FALSE);
 
-    if (!length) { WICED_BT_TRACE("dhm rx data len = 0 "); return; }
+    if (!p_stream) { return WICED_FALSE; }
 
-    STREAM_TO_UINT16(handle_and_flags, p_data);
-    STREAM_TO_UINT16(data_load_length, p_data);
+    p_stats->reserved_bufs = p_stream->reserved_bufs;
+    p_stats->reserved_in_use = atomic_load(&p_stream->reserved_in_use);
+    p_stats->shared_in_use = atomic_load(&p_stream->shared_in_use);
+    p_stats->alloc_failures = p_stream->alloc_failures;
+    p_stats->jb_lost = p_stream->jb.lost;
+    p_stats->jb_late = p_stream->jb.late;
+    p_stats->jb_overflow = p_stream->jb.overflow;
+    p_stats->credits_in_flight = p_stream->credit.in_flight;
+    p_stats->credit_starvations = p_stream->credit.starvations;
+    p_stats->credit_starved_us = p_stream->credit.starved_us;
+    // include a starvation still going on
+    if (p_stream->credit.wanted) { p_stats->credit_starved_us += clock_SystemTimeMicroseconds64() - p_stream->credit.starved_since; }
+    p_stats->mux_errors = p_stream->mux_errors;
+    p_stats->tx_sdus = p_stream->cnt.tx_sdus;
+    p_stats->tx_write_failures = p_stream->cnt.tx_write_failures;
+    p_stats->tx_completed = p_stream->cnt.tx_completed;
+    p_stats->rx_packets = p_stream->cnt.rx_packets;
+    p_stats->rx_zero_len = p_stream->cnt.rx_zero_len;
+    p_stats->oversize = p_stream->cnt.oversize;
+    p_stats->rx_malformed = p_stream->cnt.rx_malformed;
+    p_stats->rx_valid = p_stream->cnt.rx_valid;
+    p_stats->rx_possibly_invalid = p_stream->cnt.rx_possibly_invalid;
+    p_stats->rx_lost = p_stream->cnt.rx_lost;
+    p_stats->rx_missing = p_stream->cnt.rx_missing;
+    return WICED_TRUE;
+}
 
-    pb_flag = (handle_and_flags & (ISO_PKT_PB_FLAG_MASK << ISO_PKT_PB_FLAG_OFFSET)) >> ISO_PKT_PB_FLAG_OFFSET;
-    ts_flag = (handle_and_flags & (ISO_PKT_TS_FLAG_MASK << ISO_PKT_TS_FLAG_OFFSET)) >> ISO_PKT_TS_FLAG_OFFSET;
+wiced_bool_t iso_dhm_get_latency_histogram(uint16_t conn_handle, iso_dhm_latency_hist_t *p_hist)
+{
+    iso_dhm_stream_t *p_stream = iso_dhm_get_stream(conn_handle, WICED_FALSE);
 
-    handle_and_flags &= ~(ISO_PKT_PB_FLAG_MASK << ISO_PKT_PB_FLAG_OFFSET);
-    handle_and_flags &= ~(ISO_PKT_TS_FLAG_MASK << ISO_PKT_TS_FLAG_OFFSET);
-    handle_and_flags &= ~(ISO_PKT_RESERVED_FLAG_MASK << ISO_PKT_RESERVED_FLAG_OFFSET);
+    if (!p_stream) { return WICED_FALSE; }
 
-    if (ts_flag) { STREAM_TO_UINT32(ts, p_data); }
+    *p_hist = p_stream->lat.hist;
+    return WICED_TRUE;
+}
 
-    STREAM_TO_UINT16(psn, p_data);
-    STREAM_TO_UINT16(sdu_len, p_data);
+wiced_bool_t iso_dhm_enable_jitter_buffer(uint16_t conn_handle, uint8_t depth, iso_dhm_lost_psn_cb_t lost_cb)
+{
+    iso_dhm_stream_t *p_stream;
 
-    data_load_length &= ISO_PKT_DATA_LOAD_LENGTH_MASK;
-    sdu_len &= ISO_PKT_SDU_LENGTH_MASK;
+    if (depth >= ISO_DHM_JB_SLOTS) { return WICED_FALSE; }
 
-     //WICED_BT_TRACE("Recv isoc data size %d ", sdu_len);
-     //WICED_BT_TRACE_ARRAY(p_data, sdu_len, "ISO Data");
-     //WICED_BT_TRACE("TS %d PB flag %d psn %d ", ts, pb_flag, psn);
-    if(sdu_len)
-    {
-    //TRACE_ISOC_DATA(1);
-    //WICED_BT_TRACE("%d %d", sdu_len, psn);
-    //TRACE_ISOC_DATA(0);
-    }
+    if ((p_stream = iso_dhm_get_stream(conn_handle, WICED_TRUE)) == NULL) { return WICED_FALSE; }
+
+    if (!p_stream->jb.enabled) { g_jb_count++; }
+    else { iso_dhm_jb_flush(p_stream, WICED_TRUE); }
+
+    p_stream->jb.enabled = WICED_TRUE;
+    p_stream->jb.started = WICED_FALSE;
+    p_stream->jb.depth = depth;
+    p_stream->jb.lost_cb = lost_cb;
+    return WICED_TRUE;
+}
+
+void iso_dhm_register_channel_cb(uint8_t channel, iso_dhm_channel_rx_cb_t channel_cb)
+{
+    if (channel < ISO_DHM_MUX_MAX_CHANNELS) { g_channel_cbs[channel] = channel_cb; }
+}
 
-    (void)ts;
-    (void)pb_flag;
-    (void)psn;
+wiced_bool_t iso_dhm_enable_mux(uint16_t conn_handle, wiced_bool_t enable)
+{
+    iso_dhm_stream_t *p_stream;
 
-    if (!sdu_len) { return; }
+    if ((p_stream = iso_dhm_get_stream(conn_handle, enable)) == NULL) { return !enable; }
 
-    if (g_rx_data_cb) { g_rx_data_cb(handle_and_flags, p_data, sdu_len); }
+    if (enable && !p_stream->mux) { g_mux_count++; }
+    if (!enable && p_stream->mux) { g_mux_count--; }
+    p_stream->mux = enable;
+    return WICED_TRUE;
 }
 
 CY_SECTION_RAMFUNC_BEGIN
-wiced_bool_t iso_dhm_process_num_completed_pkts(uint8_t *p_buf)
+uint32_t iso_dhm_mux_pack(uint8_t *p_buf, const iso_dhm_mux_frame_t *p_frames, uint8_t num_frames)
 {
-    uint8_t num_handles, xx;
-    uint16_t handle;
-    uint16_t num_sent;
-    wiced_bool_t complete = WICED_TRUE;
+    uint32_t total = ISO_DHM_MUX_HDR_SIZE + (uint32_t)num_frames * ISO_DHM_MUX_ENTRY_SIZE;
+    uint8_t *p_table = p_buf + ISO_DHM_MUX_HDR_SIZE;
+    uint8_t *p_frame;
+    uint8_t i;
 
+    if (!num_frames || (num_frames > ISO_DHM_MUX_MAX_FRAMES)) { return 0; }
 
-    STREAM_TO_UINT8(num_handles, p_buf);
+    for (i = 0; i < num_frames; i++)
+    {
+        if ((p_frames[i].channel >= ISO_DHM_MUX_MAX_CHANNELS) || (p_frames[i].len > ISO_DHM_MUX_FRAME_LEN_MASK)) { return 0; }
+        total += p_frames[i].len;
+    }
+    if (total > g_buf_info.max_sdu_len) { return 0; }
 
-    for (xx = 0; xx < num_handles; xx++)
+    p_buf[0] = num_frames;
+    p_frame = p_table + num_frames * ISO_DHM_MUX_ENTRY_SIZE;
+    for (i = 0; i < num_frames; i++)
     {
-        STREAM_TO_UINT16(handle, p_buf);
-        STREAM_TO_UINT16(num_sent, p_buf);
+        UINT16_TO_STREAM(p_table, (uint16_t)((p_frames[i].channel << ISO_DHM_MUX_CHANNEL_OFFSET) | p_frames[i].len));
+        memcpy(p_frame, p_frames[i].p_data, p_frames[i].len);
+        p_frame += p_frames[i].len;
+    }
+    return total;
+}
+CY_SECTION_RAMFUNC_END
 
-        // WICED_BT_TRACE("[%s] handle 0x%x num_sent %d", __FUNCTION__, handle, num_sent);
+CY_SECTION_RAMFUNC_BEGIN
+wiced_bool_t iso_dhm_send_mux(uint16_t psn, uint16_t conn_handle, uint8_t ts_flag, const iso_dhm_mux_frame_t *p_frames, uint8_t num_frames)
+{
+    uint8_t *p_buf;
+    uint32_t len;
 
-        //validate handle
-        if (wiced_ble_isoc_is_cis_connected_with_conn_hdl(handle) || wiced_ble_isoc_is_bis_created(handle))
-        {
-            //callback to app to send more packets
-            if (g_num_complete_cb) {
-                    g_num_complete_cb(handle, num_sent);
-            }
-        }
-        else {
-            complete = WICED_FALSE;
-        }
+    if ((p_buf = iso_dhm_get_data_buffer_for_handle(conn_handle)) == NULL) { return WICED_FALSE; }
+
+    if ((len = iso_dhm_mux_pack(p_buf, p_frames, num_frames)) == 0)
+    {
+        iso_dhm_free_data_buffer(p_buf);
+        return WICED_FALSE;
     }
-    return complete;
+    return iso_dhm_send_packet(psn, conn_handle, ts_flag, p_buf, len);
 }
 CY_SECTION_RAMFUNC_END
 
-void iso_dhm_init(const wiced_bt_cfg_isoc_t *p_isoc_cfg,
-                  iso_dhm_num_complete_evt_cb_t num_complete_cb,
-                  iso_dhm_rx_evt_cb_t rx_data_cb)
+void iso_dhm_disable_jitter_buffer(uint16_t conn_handle)
 {
-    wiced_ble_isoc_register_data_cb(iso_dhm_process_rx_data, iso_dhm_process_num_completed_pkts);
+    iso_dhm_stream_t *p_stream = iso_dhm_get_stream(conn_handle, WICED_FALSE);
 
-    int buff_size =
-        (p_isoc_cfg->max_sdu_size * p_isoc_cfg->channel_count) + ISO_LOAD_HEADER_SIZE_WITH_TS + ISO_DATA_HEADER_SIZE;
+    if (!p_stream || !p_stream->jb.enabled) { return; }
 
-    // Allocate only once, allowing multiple calls to update callbacks
-    if (!g_cis_iso_pool)
-        g_cis_iso_pool = wiced_bt_create_pool("ISO SDU", buff_size, p_isoc_cfg->max_buffers_per_cis, NULL);
+    iso_dhm_jb_flush(p_stream, WICED_TRUE);
+    p_stream->jb.enabled = WICED_FALSE;
+    g_jb_count--;
+}
 
-    WICED_BT_TRACE("[%s] g_cis_iso_pool 0x%p size %d count %d",
-                   __FUNCTION__,
-                   g_cis_iso_pool,
-                   buff_size,
-                   p_isoc_cfg->max_buffers_per_cis);
+CY_SECTION_RAMFUNC_BEGIN
+uint16_t iso_dhm_get_num_packets(uint8_t ts_flag, uint32_t data_buf_len)
+{
+    uint32_t load_hdr_size = ts_flag ? ISO_LOAD_HEADER_SIZE_WITH_TS : ISO_LOAD_HEADER_SIZE_WITHOUT_TS;
+    uint32_t first_len = g_buf_info.iso_data_packet_len - load_hdr_size;
 
-    g_num_complete_cb = num_complete_cb;
-    g_rx_data_cb = rx_data_cb;
+    if (data_buf_len <= first_len) { return 1; }
+
+    return 1 + (data_buf_len - first_len + g_buf_info.iso_data_packet_len - 1) / g_buf_info.iso_data_packet_len;
 }
+CY_SECTION_RAMFUNC_END
 
-CY_SECTION_RAMFUNC_BEGIN
-uint8_t *iso_dhm_get_data_buffer(void)
+wiced_bool_t iso_dhm_set_tx_time_base(uint16_t conn_handle, uint16_t psn, uint32_t time_stamp, uint32_t sdu_interval)
 {
-    uint8_t *p_buf = wiced_bt_get_buffer_from_pool(g_cis_iso_pool);
+    iso_dhm_stream_t *p_stream;
 
-    if (p_buf)
-        return p_buf + ISO_LOAD_HEADER_SIZE_WITH_TS + ISO_DATA_HEADER_SIZE;
-    else
-        return NULL;
+    if (!sdu_interval || (p_stream = iso_dhm_get_stream(conn_handle, WICED_TRUE)) == NULL) { return WICED_FALSE; }
+
+    p_stream->tx.psn = psn;
+    p_stream->tx.ts = time_stamp;
+    p_stream->tx.sdu_interval = sdu_interval;
+    p_stream->tx.valid = WICED_TRUE;
+    return WICED_TRUE;
+}
+
+/* Time stamp of the SDU with PSN psn, PSNs before the time base are allowed (wrapping arithmetic) */
+CY_SECTION_RAMFUNC_BEGIN
+static uint32_t iso_dhm_tx_time_stamp(iso_dhm_stream_t *p_stream, uint16_t psn)
+{
+    return p_stream->tx.ts + (uint32_t)((int32_t)(int16_t)(psn - p_stream->tx.psn) * (int32_t)p_stream->tx.sdu_interval);
 }
 CY_SECTION_RAMFUNC_END
 
+/*
+ * Sends an SDU that does not fit in one HCI ISO data packet as a first
+ * fragment followed by continuation fragments and a last fragment. The SDU
+ * stays in place: each later fragment's 4 byte HCI ISO header is written over
+ * the tail of the fragment before it, which the lower layer has already
+ * consumed when wiced_ble_isoc_write_data_to_lower returned. Those 4 bytes
+ * are put back afterwards since the buffer may be sent on other handles too.
+ */
 CY_SECTION_RAMFUNC_BEGIN
-void iso_dhm_free_data_buffer(uint8_t *p_buf)
+static uint16_t iso_dhm_send_fragments(uint16_t psn,
+                                       uint16_t conn_handle,
+                                       uint8_t ts_flag,
+                                       uint32_t ts,
+                                       uint8_t *p_data_buf,
+                                       uint32_t data_buf_len)
 {
-    wiced_bt_free_buffer(p_buf - (ISO_LOAD_HEADER_SIZE_WITH_TS + ISO_DATA_HEADER_SIZE));
+    uint8_t *p = NULL;
+    uint8_t *p_iso_pkt = NULL;
+    uint32_t load_hdr_size = ts_flag ? ISO_LOAD_HEADER_SIZE_WITH_TS : ISO_LOAD_HEADER_SIZE_WITHOUT_TS;
+    uint32_t offset = g_buf_info.iso_data_packet_len - load_hdr_size;
+    uint16_t handle_and_flags = conn_handle;
+    uint16_t data_load_length = g_buf_info.iso_data_packet_len;
+    uint16_t written = 0;
+    uint8_t saved[ISO_DATA_HEADER_SIZE];
+    wiced_bool_t ok;
+
+    // first fragment carries the ISO_Data_Load header
+    handle_and_flags |= (ISO_PKT_PB_FLAG_FIRST_FRAGMENT << ISO_PKT_PB_FLAG_OFFSET);
+    handle_and_flags |= (ts_flag << ISO_PKT_TS_FLAG_OFFSET);
+
+    p_iso_pkt = p = p_data_buf - (load_hdr_size + ISO_DATA_HEADER_SIZE);
+
+    UINT16_TO_STREAM(p, handle_and_flags);
+    UINT16_TO_STREAM(p, data_load_length);
+    if (ts_flag) { UINT32_TO_STREAM(p, ts); }
+    UINT16_TO_STREAM(p, psn);
+    UINT16_TO_STREAM(p, data_buf_len);
+
+    if (!iso_dhm_write_to_lower(p_iso_pkt, data_load_length + ISO_DATA_HEADER_SIZE))
+    {
+        return 0;
+    }
+    written++;
+
+    while (offset < data_buf_len)
+    {
+        handle_and_flags = conn_handle;
+
+        if (data_buf_len - offset > g_buf_info.iso_data_packet_len)
+        {
+            data_load_length = g_buf_info.iso_data_packet_len;
+            handle_and_flags |= (ISO_PKT_PB_FLAG_CONTINUATION_FRAGMENT << ISO_PKT_PB_FLAG_OFFSET);
+        }
+        else
+        {
+            data_load_length = data_buf_len - offset;
+            handle_and_flags |= (ISO_PKT_PB_FLAG_LAST_FRAGMENT << ISO_PKT_PB_FLAG_OFFSET);
+        }
+
+        p_iso_pkt = p = p_data_buf + offset - ISO_DATA_HEADER_SIZE;
+        memcpy(saved, p_iso_pkt, ISO_DATA_HEADER_SIZE);
+
+        UINT16_TO_STREAM(p, handle_and_flags);
+        UINT16_TO_STREAM(p, data_load_length);
+
+        ok = iso_dhm_write_to_lower(p_iso_pkt, data_load_length + ISO_DATA_HEADER_SIZE);
+        memcpy(p_iso_pkt, saved, ISO_DATA_HEADER_SIZE);
+        if (!ok)
+        {
+            WICED_BT_TRACE_CRIT("ISO fragment write failed psn %d offset %d", psn, (int)offset);
+            return written;
+        }
+        written++;
+
+        offset += data_load_length;
+    }
+
+    return written;
 }
 CY_SECTION_RAMFUNC_END
 
@@ -204,45 +1710,85 @@ wiced_bool_t iso_dhm_send_packet(uint16_t psn,
     uint8_t *p_iso_sdu = NULL;
     uint16_t handle_and_flags = conn_handle;
     uint16_t data_load_length = 0;
-//    uint16_t psn = 0xFFFF;
+    uint32_t load_hdr_size;
+    uint32_t ts = 0;
+    uint16_t num_pkts, written;
+    iso_dhm_stream_t *p_stream = iso_dhm_get_stream(conn_handle, WICED_FALSE);
 
     wiced_bool_t result = WICED_FALSE;
 
-    if (data_buf_len > 550 /*FIXME:get the max supported buffer size from controller*/)
+    // without a time base the controller places the SDU, as if ts_flag was not set
+    if (ts_flag)
+    {
+        if (p_stream && p_stream->tx.valid)
+        {
+            ts = iso_dhm_tx_time_stamp(p_stream, psn);
+        }
+        else
+        {
+            ts_flag = 0;
+        }
+    }
+    load_hdr_size = ts_flag ? ISO_LOAD_HEADER_SIZE_WITH_TS : ISO_LOAD_HEADER_SIZE_WITHOUT_TS;
+
+    if (p_stream) { p_stream->cnt.tx_sdus++; }
+
+    if (data_buf_len > g_buf_info.max_sdu_len)
     {
-    WICED_BT_TRACE_CRIT("Received packet larger than the ISO SDU len supported");
+        WICED_BT_TRACE_CRIT("Received packet larger than the ISO SDU len supported");
+        if (p_stream) { p_stream->cnt.oversize++; }
+        iso_dhm_free_data_buffer(p_data_buf);
         return WICED_FALSE;
     }
 
     //TRACE_SEND_PKT(1);
     //TRACE_RX_ISR(1);
 
-    handle_and_flags |= (ISO_PKT_PB_FLAG_COMPLETE << ISO_PKT_PB_FLAG_OFFSET);
-    handle_and_flags |= (ts_flag << ISO_PKT_TS_FLAG_OFFSET);
+#ifdef ISO_DHM_SHM_DATA_PATH
+    if (p_stream && p_stream->shm) { return iso_dhm_shm_send(p_stream, psn, ts_flag, ts, p_data_buf, data_buf_len); }
+#endif
 
-    if (ts_flag)
+    num_pkts = iso_dhm_get_num_packets(ts_flag, data_buf_len);
+    if (!iso_dhm_take_credits(p_stream, conn_handle, num_pkts))
     {
-        //timestamp supported, header size is 4 + 8
-        p_iso_sdu = p = p_data_buf - (ISO_LOAD_HEADER_SIZE_WITH_TS + ISO_DATA_HEADER_SIZE);
-        data_load_length = data_buf_len + ISO_LOAD_HEADER_SIZE_WITH_TS;
+        iso_dhm_free_data_buffer(p_data_buf);
+        return WICED_FALSE;
     }
-    else
+
+    if (num_pkts > 1)
     {
-        //timestamp not supported, header size is 4 + 4
-        p_iso_sdu = p = p_data_buf - (ISO_LOAD_HEADER_SIZE_WITHOUT_TS + ISO_DATA_HEADER_SIZE);
-        data_load_length = data_buf_len + ISO_LOAD_HEADER_SIZE_WITHOUT_TS;
+        written = iso_dhm_send_fragments(psn, conn_handle, ts_flag, ts, p_data_buf, data_buf_len);
+        iso_dhm_lat_sent(p_stream, written);
+        if (written < num_pkts)
+        {
+            iso_dhm_return_credits(p_stream, num_pkts - written);
+            if (p_stream) { p_stream->cnt.tx_write_failures++; }
+        }
+        iso_dhm_free_data_buffer(p_data_buf);
+        return written == num_pkts;
     }
 
-    data_load_length &= ISO_PKT_DATA_LOAD_LENGTH_MASK;
-    data_buf_len &= ISO_PKT_SDU_LENGTH_MASK;
+    handle_and_flags |= (ISO_PKT_PB_FLAG_COMPLETE << ISO_PKT_PB_FLAG_OFFSET);
+    handle_and_flags |= (ts_flag << ISO_PKT_TS_FLAG_OFFSET);
+
+    //timestamp supported, header size is 4 + 8, otherwise 4 + 4
+    p_iso_sdu = p = p_data_buf - (load_hdr_size + ISO_DATA_HEADER_SIZE);
+    data_load_length = data_buf_len + load_hdr_size;
 
     UINT16_TO_STREAM(p, handle_and_flags);
     UINT16_TO_STREAM(p, data_load_length);
+    if (ts_flag) { UINT32_TO_STREAM(p, ts); }
     UINT16_TO_STREAM(p, psn);
     UINT16_TO_STREAM(p, data_buf_len);
 
     //result = btu_write_iso_to_lower(BT_TRANSPORT_LE, p_iso_sdu, data_load_length + ISO_DATA_HEADER_SIZE);
-    result = wiced_ble_isoc_write_data_to_lower(p_iso_sdu, data_load_length + ISO_DATA_HEADER_SIZE);
+    result = iso_dhm_write_to_lower(p_iso_sdu, data_load_length + ISO_DATA_HEADER_SIZE);
+    if (result) { iso_dhm_lat_sent(p_stream, 1); }
+    else
+    {
+        iso_dhm_return_credits(p_stream, 1);
+        if (p_stream) { p_stream->cnt.tx_write_failures++; }
+    }
 
     //TRACE_RES_5(1);
     iso_dhm_free_data_buffer(p_data_buf);
@@ -255,6 +1801,353 @@ wiced_bool_t iso_dhm_send_packet(uint16_t psn,
 }
 CY_SECTION_RAMFUNC_END
 
+/*
+ * wiced_ble_isoc_write_data_to_lower takes each HCI ISO data packet as one
+ * contiguous buffer, so the pieces are gathered once, straight behind the
+ * headroom the ISO headers are written into.
+ */
+CY_SECTION_RAMFUNC_BEGIN
+wiced_bool_t iso_dhm_send_packet_sg(uint16_t psn,
+                                    uint16_t conn_handle,
+                                    uint8_t ts_flag,
+                                    const iso_dhm_iovec_t *p_iov,
+                                    uint8_t iov_cnt)
+{
+    iso_dhm_stream_t *p_stream;
+    uint32_t len = 0;
+    uint8_t *p_buf;
+    uint8_t *p;
+    uint8_t i;
+
+    for (i = 0; i < iov_cnt; i++) { len += p_iov[i].len; }
+
+    if (len > g_buf_info.max_sdu_len)
+    {
+        WICED_BT_TRACE_CRIT("SDU of %d bytes larger than the ISO SDU len supported", (int)len);
+        if ((p_stream = iso_dhm_get_stream(conn_handle, WICED_FALSE)) != NULL)
+        {
+            p_stream->cnt.tx_sdus++;
+            p_stream->cnt.oversize++;
+        }
+        return WICED_FALSE;
+    }
+
+    if ((p_buf = iso_dhm_get_data_buffer_for_handle(conn_handle)) == NULL) { return WICED_FALSE; }
+
+    for (p = p_buf, i = 0; i < iov_cnt; i++)
+    {
+        memcpy(p, p_iov[i].p_base, p_iov[i].len);
+        p += p_iov[i].len;
+    }
+
+    return iso_dhm_send_packet(psn, conn_handle, ts_flag, p_buf, len);
+}
+CY_SECTION_RAMFUNC_END
+
+/*
+ * The lower layer copies each packet before wiced_ble_isoc_write_data_to_lower
+ * returns, so one buffer serves every handle in turn: only the headroom is
+ * rewritten with the next handle's HCI ISO headers.
+ */
+CY_SECTION_RAMFUNC_BEGIN
+uint8_t iso_dhm_send_packet_fanout(uint16_t psn,
+                                   const uint16_t *p_conn_handles,
+                                   uint8_t num_handles,
+                                   uint8_t ts_flag,
+                                   uint8_t *p_data_buf,
+                                   uint32_t data_buf_len)
+{
+    iso_dhm_buf_tag_t *p_tag = (iso_dhm_buf_tag_t *)(p_data_buf - ISO_DHM_BUF_HEADROOM);
+    uint8_t sent = 0;
+    uint8_t i;
+
+    // every iso_dhm_send_packet drops one reference
+    if (!num_handles || !iso_dhm_buf_add_refs(p_tag, num_handles - 1))
+    {
+        iso_dhm_free_data_buffer(p_data_buf);
+        return 0;
+    }
+
+    for (i = 0; i < num_handles; i++)
+    {
+        if (iso_dhm_send_packet(psn, p_conn_handles[i], ts_flag, p_data_buf, data_buf_len)) { sent++; }
+    }
+    return sent;
+}
+CY_SECTION_RAMFUNC_END
+
+/*
+ * Runs of SDUs that fit in one HCI ISO data packet get all their headers
+ * built in one pass and are then written back to back. An SDU that needs
+ * segmentation breaks the run and goes through iso_dhm_send_packet.
+ */
+CY_SECTION_RAMFUNC_BEGIN
+uint8_t iso_dhm_send_burst(uint16_t conn_handle,
+                           uint16_t first_psn,
+                           uint8_t ts_flag,
+                           uint8_t *p_bufs[],
+                           const uint32_t lens[],
+                           uint8_t n)
+{
+    uint16_t handle_and_flags = conn_handle | (ISO_PKT_PB_FLAG_COMPLETE << ISO_PKT_PB_FLAG_OFFSET);
+    iso_dhm_stream_t *p_stream = NULL;
+    uint32_t load_hdr_size;
+    uint32_t max_single_len;
+    uint8_t sent = 0;
+    uint8_t unfreed;
+    uint8_t end;
+    uint8_t i;
+
+    p_stream = iso_dhm_get_stream(conn_handle, WICED_FALSE);
+    if (ts_flag)
+    {
+        if (!p_stream || !p_stream->tx.valid) { ts_flag = 0; }
+        else { handle_and_flags |= (1 << ISO_PKT_TS_FLAG_OFFSET); }
+    }
+    load_hdr_size = ts_flag ? ISO_LOAD_HEADER_SIZE_WITH_TS : ISO_LOAD_HEADER_SIZE_WITHOUT_TS;
+    max_single_len = g_buf_info.iso_data_packet_len - load_hdr_size;
+
+    if (max_single_len > g_buf_info.max_sdu_len) { max_single_len = g_buf_info.max_sdu_len; }
+
+#ifdef ISO_DHM_SHM_DATA_PATH
+    // no headers to build, every SDU takes one ring slot
+    if (p_stream && p_stream->shm)
+    {
+        for (; sent < n; sent++)
+        {
+            if (!iso_dhm_send_packet(first_psn + sent, conn_handle, ts_flag, p_bufs[sent], lens[sent]))
+            {
+                unfreed = sent + 1;
+                goto stop;
+            }
+        }
+        return sent;
+    }
+#endif
+
+    while (sent < n)
+    {
+        // header pass over the run of single packet SDUs
+        for (end = sent; (end < n) && (lens[end] <= max_single_len); end++)
+        {
+            uint8_t *p = p_bufs[end] - (load_hdr_size + ISO_DATA_HEADER_SIZE);
+            uint16_t data_load_length = lens[end] + load_hdr_size;
+
+            UINT16_TO_STREAM(p, handle_and_flags);
+            UINT16_TO_STREAM(p, data_load_length);
+            if (ts_flag) { UINT32_TO_STREAM(p, iso_dhm_tx_time_stamp(p_stream, (uint16_t)(first_psn + end))); }
+            UINT16_TO_STREAM(p, (uint16_t)(first_psn + end));
+            UINT16_TO_STREAM(p, lens[end]);
+        }
+
+        // write pass
+        for (; sent < end; sent++)
+        {
+            if (p_stream) { p_stream->cnt.tx_sdus++; }
+            if (!iso_dhm_take_credits(p_stream, conn_handle, 1))
+            {
+                unfreed = sent;
+                goto stop;
+            }
+            if (!iso_dhm_write_to_lower(p_bufs[sent] - (load_hdr_size + ISO_DATA_HEADER_SIZE),
+                                        lens[sent] + load_hdr_size + ISO_DATA_HEADER_SIZE))
+            {
+                iso_dhm_return_credits(p_stream, 1);
+                if (p_stream) { p_stream->cnt.tx_write_failures++; }
+                unfreed = sent;
+                goto stop;
+            }
+            iso_dhm_lat_sent(p_stream, 1);
+            iso_dhm_free_data_buffer(p_bufs[sent]);
+        }
+
+        if (sent == n) { break; }
+
+        // segmented or oversize SDU, iso_dhm_send_packet frees it either way
+        if (!iso_dhm_send_packet(first_psn + sent, conn_handle, ts_flag, p_bufs[sent], lens[sent]))
+        {
+            unfreed = sent + 1;
+            goto stop;
+        }
+        sent++;
+    }
+    return sent;
+
+stop:
+    WICED_BT_TRACE("[%s] burst stopped at %d of %d", __FUNCTION__, sent, n);
+    for (i = unfreed; i < n; i++) { iso_dhm_free_data_buffer(p_bufs[i]); }
+    return sent;
+}
+CY_SECTION_RAMFUNC_END
+
+void iso_dhm_remove_handle(uint16_t conn_handle)
+{
+    iso_dhm_stream_t *p_stream = iso_dhm_get_stream(conn_handle, WICED_FALSE);
+
+    // the controller may hand the handle to another CIS or BIS next
+    iso_dhm_register_handle_rx_cb(conn_handle, NULL, NULL);
+
+    if (!p_stream) { return; }
+
+    iso_dhm_rx_reassembly_abort(p_stream);
+    if (p_stream->jb.enabled)
+    {
+        iso_dhm_jb_flush(p_stream, WICED_FALSE);
+        g_jb_count--;
+    }
+    if (p_stream->mux) { g_mux_count--; }
+    g_reserved_bufs_total -= p_stream->reserved_bufs;
+
+    // the controller drops whatever was still queued for the handle
+    iso_dhm_return_credits(NULL, p_stream->credit.in_flight);
+    if (p_stream->credit.wanted) { g_credit_waiters--; }
+
+    p_stream->in_use = WICED_FALSE;
+}
+
+#ifdef ISO_DHM_SHM_DATA_PATH
+uint8_t iso_dhm_shm_get_csc(wiced_bool_t input, uint8_t *p_csc)
+{
+    uintptr_t addr = (uintptr_t)(input ? &g_shm_tx : &g_shm_rx);
+    uint8_t *p = p_csc;
+    uint8_t i;
+
+    UINT8_TO_STREAM(p, ISO_DHM_SHM_RING_SLOTS);
+    UINT16_TO_STREAM(p, ISO_DHM_SLAB_SDU_SIZE);
+    for (i = 0; i < sizeof(addr); i++) { UINT8_TO_STREAM(p, (uint8_t)(addr >> (8 * i))); }
+    return (uint8_t)(p - p_csc);
+}
+
+wiced_bool_t iso_dhm_shm_enable(uint16_t conn_handle, wiced_bool_t enable)
+{
+    iso_dhm_stream_t *p_stream;
+
+    if ((p_stream = iso_dhm_get_stream(conn_handle, enable)) == NULL) { return !enable; }
+
+    p_stream->shm = enable;
+    return WICED_TRUE;
+}
+
+CY_SECTION_RAMFUNC_BEGIN
+uint32_t iso_dhm_shm_poll(void)
+{
+    iso_dhm_stream_t *p_stream;
+    iso_dhm_shm_slot_t *p_slot;
+    iso_dhm_rx_meta_t meta;
+    uint32_t done = 0;
+    uint32_t end;
+    uint16_t conn_handle;
+    uint16_t num;
+
+    // SDUs the controller took, reported like completed packets, one call per run of a handle
+    end = g_shm_tx.tail;
+    atomic_thread_fence(memory_order_acquire);
+    while (g_shm_tx_done != end)
+    {
+        conn_handle = g_shm_tx.slot[g_shm_tx_done & (ISO_DHM_SHM_RING_SLOTS - 1)].conn_handle;
+        for (num = 0; (g_shm_tx_done != end)
+             && (g_shm_tx.slot[g_shm_tx_done & (ISO_DHM_SHM_RING_SLOTS - 1)].conn_handle == conn_handle); num++)
+        {
+            g_shm_tx_done++;
+        }
+        done += num;
+
+        if (!(g_valid_handles[conn_handle >> 5] & (1u << (conn_handle & 0x1F)))) { continue; }
+        if ((p_stream = iso_dhm_get_stream(conn_handle, WICED_FALSE)) != NULL) { iso_dhm_lat_completed(p_stream, num); }
+        if (g_num_complete_cb) { g_num_complete_cb(conn_handle, num); }
+    }
+    if (g_credit_waiters) { iso_dhm_notify_credits(); }
+
+    end = g_shm_rx.head;
+    atomic_thread_fence(memory_order_acquire);
+    while (g_shm_rx.tail != end)
+    {
+        p_slot = &g_shm_rx.slot[g_shm_rx.tail & (ISO_DHM_SHM_RING_SLOTS - 1)];
+        meta.conn_handle = p_slot->conn_handle & ISO_DHM_HANDLE_MASK;
+        meta.psn = p_slot->psn;
+        meta.ts = p_slot->ts;
+        meta.ts_valid = p_slot->ts_valid;
+        meta.packet_status = p_slot->packet_status;
+        meta.sdu_len = p_slot->sdu_len;
+
+        p_stream = iso_dhm_get_stream(meta.conn_handle, WICED_FALSE);
+        if (p_stream) { p_stream->cnt.rx_packets++; }
+
+        if (meta.sdu_len > sizeof(p_slot->sdu))
+        {
+            if (p_stream) { p_stream->cnt.oversize++; }
+        }
+        else
+        {
+            // the jitter buffer copies what it holds, the slot is only borrowed
+            iso_dhm_rx_sdu(p_stream, &meta, p_slot->sdu, NULL);
+        }
+
+        // done with the slot before the controller may refill it
+        atomic_thread_fence(memory_order_release);
+        g_shm_rx.tail++;
+        done++;
+    }
+
+    return done;
+}
+CY_SECTION_RAMFUNC_END
+#endif
+
+#ifdef ISO_DHM_CAPTURE
+void iso_dhm_capture_enable(wiced_bool_t enable)
+{
+    g_capture.enabled = enable;
+}
+
+void iso_dhm_capture_clear(void)
+{
+    g_capture.next = 0;
+}
+
+uint32_t iso_dhm_capture_dump(iso_dhm_capture_write_cb_t write_cb)
+{
+    uint8_t hdr[ISO_DHM_BTSNOOP_RECORD_HDR_SIZE];
+    uint8_t h4_type = ISO_DHM_H4_ISO_DATA;
+    uint32_t count = (g_capture.next < ISO_DHM_CAPTURE_SLOTS) ? g_capture.next : ISO_DHM_CAPTURE_SLOTS;
+    uint32_t first = g_capture.next - count;
+    uint64_t ts;
+    uint32_t incl_len;
+    uint32_t i;
+    uint8_t *p;
+
+    // file header: identification pattern, version, datalink type
+    memcpy(hdr, "btsnoop", 8);
+    p = &hdr[8];
+    UINT32_TO_BE_STREAM(p, ISO_DHM_BTSNOOP_VERSION);
+    UINT32_TO_BE_STREAM(p, ISO_DHM_BTSNOOP_DATALINK_H4);
+    write_cb(hdr, 16);
+
+    for (i = first; i != g_capture.next; i++)
+    {
+        uint32_t idx = i % ISO_DHM_CAPTURE_SLOTS;
+
+        incl_len = (g_capture.slot[idx].len < ISO_DHM_CAPTURE_SNAPLEN) ? g_capture.slot[idx].len : ISO_DHM_CAPTURE_SNAPLEN;
+        ts = g_capture.slot[idx].ts_us + ISO_DHM_BTSNOOP_EPOCH_DELTA_US;
+
+        // lengths include the H4 packet type byte, drops are the packets overwritten before this one
+        p = hdr;
+        UINT32_TO_BE_STREAM(p, g_capture.slot[idx].len + 1);
+        UINT32_TO_BE_STREAM(p, incl_len + 1);
+        UINT32_TO_BE_STREAM(p, g_capture.slot[idx].received ? ISO_DHM_BTSNOOP_FLAG_RECEIVED : 0);
+        UINT32_TO_BE_STREAM(p, first);
+        UINT32_TO_BE_STREAM(p, (uint32_t)(ts >> 32));
+        UINT32_TO_BE_STREAM(p, (uint32_t)ts);
+
+        write_cb(hdr, ISO_DHM_BTSNOOP_RECORD_HDR_SIZE);
+        write_cb(&h4_type, 1);
+        write_cb(g_capture.slot[idx].data, incl_len);
+    }
+
+    return count;
+}
+#endif
+
 uint32_t iso_dhm_get_header_size()
 {
     return ISO_LOAD_HEADER_SIZE_WITH_TS + ISO_DATA_HEADER_SIZE;
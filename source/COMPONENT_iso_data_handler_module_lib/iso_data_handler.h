@@ -32,18 +32,311 @@
 
 #include "wiced_bt_cfg.h"
 
+/* Static SDU slab, sized at build time (e.g. DEFINES+=ISO_DHM_SLAB_SDU_SIZE=100).
+ * The slab must cover max_sdu_size * channel_count and the buffer count worked out
+ * from the ISOC config; anything beyond it is capped. */
+#ifndef ISO_DHM_SLAB_SDU_SIZE
+#define ISO_DHM_SLAB_SDU_SIZE 512
+#endif
+#ifndef ISO_DHM_SLAB_BUF_COUNT
+#define ISO_DHM_SLAB_BUF_COUNT 8
+#endif
+
+/* HCI ISO data packet capture, built with DEFINES+=ISO_DHM_CAPTURE. The last ISO_DHM_CAPTURE_SLOTS
+ * packets sent or received are kept in RAM, each truncated to ISO_DHM_CAPTURE_SNAPLEN bytes. */
+#ifdef ISO_DHM_CAPTURE
+#ifndef ISO_DHM_CAPTURE_SLOTS
+#define ISO_DHM_CAPTURE_SLOTS 32
+#endif
+#ifndef ISO_DHM_CAPTURE_SNAPLEN
+#define ISO_DHM_CAPTURE_SNAPLEN 128
+#endif
+#endif
+
+/* Shared memory ISO data path, built with DEFINES+=ISO_DHM_SHM_DATA_PATH. SDUs of the handles it is
+ * enabled for are exchanged with the controller through two rings in RAM both sides can reach,
+ * one per direction, instead of as HCI ISO data packets. The rings are set up as a vendor specific
+ * data path (ISO_DHM_SHM_DATA_PATH_ID) with a vendor codec whose configuration locates them. */
+#ifdef ISO_DHM_SHM_DATA_PATH
+#ifndef ISO_DHM_SHM_RING_SLOTS
+#define ISO_DHM_SHM_RING_SLOTS 8            // power of two
+#endif
+#ifndef ISO_DHM_SHM_DATA_PATH_ID
+#define ISO_DHM_SHM_DATA_PATH_ID 0x01       // 0x00 is HCI, 0x01..0xFE are vendor specific
+#endif
+#define ISO_DHM_SHM_CODING_FORMAT 0xFF      // vendor specific
+#ifndef ISO_DHM_SHM_COMPANY_ID
+#define ISO_DHM_SHM_COMPANY_ID 0x0009       // Infineon Technologies AG
+#endif
+#ifndef ISO_DHM_SHM_VENDOR_CODEC_ID
+#define ISO_DHM_SHM_VENDOR_CODEC_ID 0x0001
+#endif
+// Codec_Configuration: slot count (1), slot SDU size (2), ring address (pointer size), little endian
+#define ISO_DHM_SHM_CSC_LEN (3 + sizeof(uintptr_t))
+#endif
+
+/* ISO data buffer geometry, from HCI LE Read Buffer Size v2 once the controller answers */
+typedef struct
+{
+    uint16_t iso_data_packet_len;           // max ISO_Data_Load length of one HCI ISO data packet
+    uint8_t total_num_iso_data_packets;     // controller credits shared by all CIS/BIS
+    wiced_bool_t from_controller;           // WICED_FALSE while the defaults are in use
+    uint32_t max_sdu_len;                   // largest SDU iso_dhm_send_packet accepts
+    uint32_t pool_buf_size;
+    uint8_t pool_buf_count;
+} iso_dhm_buffer_info_t;
+
+/* SDU slab usage, counters never reset */
+typedef struct
+{
+    uint32_t slot_size;                     // bytes per buffer, headroom included
+    uint32_t slot_count;                    // buffers in use by the data handler
+    uint32_t live;                          // buffers allocated now
+    uint32_t peak;                          // most buffers ever allocated at once
+    uint32_t failed;                        // allocations that found the slab empty
+} iso_dhm_slab_stats_t;
+
+/* Per-handle buffer usage */
+typedef struct
+{
+    uint8_t reserved_bufs;                  // quota reserved by iso_dhm_add_handle
+    uint8_t reserved_in_use;
+    uint8_t shared_in_use;                  // buffers held from the shared overflow region
+    uint32_t alloc_failures;
+    uint32_t jb_lost;                       // PSNs the jitter buffer reported lost
+    uint32_t jb_late;                       // SDUs dropped as late or duplicate
+    uint32_t jb_overflow;                   // SDUs dropped for lack of a buffer
+    uint16_t credits_in_flight;             // ISO data packets sent, not yet completed
+    uint32_t credit_starvations;            // times a send found too few controller credits
+    uint64_t credit_starved_us;             // total time spent waiting for credits
+    uint32_t mux_errors;                    // multiplexed SDUs dropped for a bad channel table
+    uint32_t tx_sdus;                       // SDUs the data handler tried to send
+    uint32_t tx_write_failures;             // SDUs wiced_ble_isoc_write_data_to_lower refused
+    uint32_t tx_completed;                  // ISO data packets reported by Number Of Completed Packets
+    uint32_t rx_packets;                    // HCI ISO data packets received
+    uint32_t rx_zero_len;                   // SDUs received empty, e.g. lost
+    uint32_t oversize;                      // SDUs over max_sdu_len, sent or received
+    uint32_t rx_malformed;                  // complete SDUs longer than their packet's data
+    uint32_t rx_valid;                      // SDUs received per Packet_Status_Flag
+    uint32_t rx_possibly_invalid;
+    uint32_t rx_lost;
+    uint32_t rx_missing;                    // PSNs skipped, never received at all
+} iso_dhm_handle_stats_t;
+
+/* Send-to-complete latency histogram, log2 buckets */
+#define ISO_DHM_LATENCY_BUCKETS 20
+
+/* Time from writing each ISO data packet to the controller until Number Of Completed Packets
+ * reports it. bucket[i] counts times of 2^i to 2^(i+1) - 1 us (bucket 0 also 0 us), the last
+ * bucket everything longer. Packets sent while 16 or more are in flight are only counted in
+ * untimed. */
+typedef struct
+{
+    uint32_t bucket[ISO_DHM_LATENCY_BUCKETS];
+    uint64_t total_us;                      // sum of all timed packets, for the mean
+    uint32_t max_us;
+    uint32_t untimed;
+} iso_dhm_latency_hist_t;
+
+/* Packet_Status_Flag of a received SDU */
+#define ISO_DHM_PKT_STATUS_VALID 0
+#define ISO_DHM_PKT_STATUS_POSSIBLY_INVALID 1
+#define ISO_DHM_PKT_STATUS_LOST 2
+
+/* Received SDU metadata for the v2 RX callback */
+typedef struct
+{
+    uint16_t conn_handle;
+    uint16_t psn;
+    uint32_t ts;                            // controller time stamp in us, only if ts_valid
+    wiced_bool_t ts_valid;
+    uint8_t packet_status;                  // ISO_DHM_PKT_STATUS_xxx
+    uint16_t sdu_len;
+} iso_dhm_rx_meta_t;
+
 typedef void (*iso_dhm_num_complete_evt_cb_t)(uint16_t cis_handle, uint16_t num_sent);
 typedef void (*iso_dhm_rx_evt_cb_t)(uint16_t cis_handle, uint8_t *p_data, uint32_t length);
+/* Unlike iso_dhm_rx_evt_cb_t it is also called for empty SDUs, e.g. lost ones */
+typedef void (*iso_dhm_rx_evt_v2_cb_t)(const iso_dhm_rx_meta_t *p_meta, uint8_t *p_data);
+/* Credits the handle was starved of are free again, num_credits is the total now free */
+typedef void (*iso_dhm_credits_available_cb_t)(uint16_t conn_handle, uint16_t num_credits);
+/* Channel multiplexing: channel ids 0..15, up to 16 frames per SDU */
+#define ISO_DHM_MUX_MAX_CHANNELS 16
+#define ISO_DHM_MUX_MAX_FRAMES 16
+
+/* One channel's frame of a multiplexed SDU */
+typedef struct
+{
+    uint8_t channel;
+    const uint8_t *p_data;
+    uint16_t len;
+} iso_dhm_mux_frame_t;
+
+/* One frame of a multiplexed SDU, p_meta describes the whole SDU */
+typedef void (*iso_dhm_channel_rx_cb_t)(const iso_dhm_rx_meta_t *p_meta, uint8_t channel, uint8_t *p_data, uint16_t len);
+/* RX callback bound to one handle, p_ctx is the pointer given at registration */
+typedef void (*iso_dhm_handle_rx_cb_t)(void *p_ctx, const iso_dhm_rx_meta_t *p_meta, uint8_t *p_data);
+/* Jitter buffer loss report, for a PSN never received or received with ISO_DHM_PKT_STATUS_LOST */
+typedef void (*iso_dhm_lost_psn_cb_t)(uint16_t conn_handle, uint16_t psn);
 
 void iso_dhm_init(const wiced_bt_cfg_isoc_t *p_isoc_cfg, iso_dhm_num_complete_evt_cb_t num_complete_cb, iso_dhm_rx_evt_cb_t rx_data_cb);
 
+/* Adds a v2 RX callback; the one passed to iso_dhm_init keeps being called as well */
+void iso_dhm_register_rx_v2_cb(iso_dhm_rx_evt_v2_cb_t rx_data_v2_cb);
+
+/* Binds rx_cb and p_ctx to one CIS or BIS handle; its SDUs, empty ones included, then go to rx_cb
+ * instead of the callbacks above. A NULL rx_cb unbinds the handle, as does iso_dhm_remove_handle.
+ * Handles share a slot when equal modulo 8, so binding fails if another handle holds the slot. */
+wiced_bool_t iso_dhm_register_handle_rx_cb(uint16_t conn_handle, iso_dhm_handle_rx_cb_t rx_cb, void *p_ctx);
+
+/* Concealment hook, called as soon as an interval is known to have no usable data: for an SDU
+ * received with ISO_DHM_PKT_STATUS_LOST and for each PSN skipped before a received SDU. It runs
+ * on arrival, ahead of any jitter buffer delay, and only for handles added with iso_dhm_add_handle.
+ * A PSN reported skipped may still turn up later, out of order. */
+void iso_dhm_register_conceal_cb(iso_dhm_lost_psn_cb_t conceal_cb);
+
+const iso_dhm_buffer_info_t *iso_dhm_get_buffer_info(void);
+void iso_dhm_get_slab_stats(iso_dhm_slab_stats_t *p_stats);
+
+/* Buffers not bound to a handle come from the shared overflow region only */
 uint8_t *iso_dhm_get_data_buffer(void);
+/* Draws from the handle's reserved quota first, then from the shared region */
+uint8_t *iso_dhm_get_data_buffer_for_handle(uint16_t conn_handle);
+/* Drops one reference, the buffer goes back to the pool with the last one */
 void iso_dhm_free_data_buffer(uint8_t *p_buf);
+/* Adds a reference so the buffer can be passed to one more send (or free) call, e.g. to send
+ * the same SDU on several handles without copying it. Senders rewrite only the headroom, the
+ * SDU itself is unchanged when a send returns. Up to 254 extra references, each dropped by
+ * any task. A referenced buffer must not appear twice in one iso_dhm_send_burst. */
+wiced_bool_t iso_dhm_ref_data_buffer(uint8_t *p_buf);
 
 //void iso_dhm_send_packet(wiced_bool_t is_cis, uint16_t conn_handle, uint8_t ts_flag, uint8_t *p_data_buf, uint32_t data_buf_len);
 wiced_bool_t iso_dhm_send_packet(uint16_t psn, uint16_t conn_handle, uint8_t ts_flag, uint8_t *p_data_buf, uint32_t data_buf_len);
 
+/* One piece of an SDU for iso_dhm_send_packet_sg */
+typedef struct
+{
+    const uint8_t *p_base;
+    uint32_t len;
+} iso_dhm_iovec_t;
+
+/* Sends the SDU made of the iov_cnt pieces in order, e.g. an application header and payload
+ * fragments held in the producer's own buffers. The pieces are copied once into a buffer of
+ * the handle; the caller keeps ownership of them. Otherwise like iso_dhm_send_packet. */
+wiced_bool_t iso_dhm_send_packet_sg(uint16_t psn, uint16_t conn_handle, uint8_t ts_flag, const iso_dhm_iovec_t *p_iov, uint8_t iov_cnt);
+
+/* Sends one SDU with the same PSN on each of the num_handles handles, e.g. every BIS of a BIG,
+ * from the one buffer. Takes ownership of the buffer. Returns the number of handles it was
+ * handed to the controller on. */
+uint8_t iso_dhm_send_packet_fanout(uint16_t psn, const uint16_t *p_conn_handles, uint8_t num_handles, uint8_t ts_flag, uint8_t *p_data_buf, uint32_t data_buf_len);
+
+/* Sends n SDUs with PSNs first_psn, first_psn + 1, ... on one handle.
+ * Like iso_dhm_send_packet it takes ownership of every buffer, sent or not.
+ * Returns the number of SDUs handed to the controller; the burst stops at the first failure. */
+uint8_t iso_dhm_send_burst(uint16_t conn_handle, uint16_t first_psn, uint8_t ts_flag, uint8_t *p_bufs[], const uint32_t lens[], uint8_t n);
+
+/* Anchors the handle's TX time stamps to the controller time base: the SDU with PSN psn gets
+ * time_stamp and each following PSN sdu_interval us more. Use the TX_Time_Stamp plus Time_Offset
+ * reported by LE Read ISO TX Sync. With ts_flag set, iso_dhm_send_packet and iso_dhm_send_burst
+ * stamp every SDU so that the controller sends it in the ISO event of its PSN; without a time
+ * base they send it unstamped. */
+wiced_bool_t iso_dhm_set_tx_time_base(uint16_t conn_handle, uint16_t psn, uint32_t time_stamp, uint32_t sdu_interval);
+
+/* Number of HCI ISO data packets (controller credits) iso_dhm_send_packet uses for an SDU of data_buf_len bytes */
+uint16_t iso_dhm_get_num_packets(uint8_t ts_flag, uint32_t data_buf_len);
+
 wiced_bool_t iso_dhm_process_num_completed_pkts(uint8_t *p_buf);
+/* The data handler counts controller credits (ISO data packets): each HCI ISO data packet
+ * sent takes one, Number Of Completed Packets gives them back and removing a handle returns
+ * what it had in flight. iso_dhm_send_packet / iso_dhm_send_burst reject SDUs for which too
+ * few credits are free; the handle then counts as starved until the credits available
+ * callback reports them free again. */
+void iso_dhm_register_credits_cb(iso_dhm_credits_available_cb_t credits_cb);
+uint16_t iso_dhm_get_credits(void);
+/* WICED_TRUE if num credits are free; otherwise starts a starvation period for the handle
+ * that ends with the credits available callback */
+wiced_bool_t iso_dhm_has_credits(uint16_t conn_handle, uint16_t num);
+
+/* Number Of Completed Packets is only passed on for handles marked valid here. Mark a CIS
+ * valid on CIS established and invalid on CIS disconnected, and every BIS of a BIG on BIG
+ * created / BIG terminated. */
+void iso_dhm_set_handle_valid(uint16_t conn_handle, wiced_bool_t valid);
 void iso_dhm_process_rx_data(uint8_t *p_data, uint32_t length);
 uint32_t iso_dhm_get_header_size();
+
+/* Registers a CIS or BIS handle and reserves reserved_bufs pool buffers for it alone.
+ * The rest of the pool is shared overflow. Calling it again changes the reservation. */
+wiced_bool_t iso_dhm_add_handle(uint16_t conn_handle, uint8_t reserved_bufs);
+/* Releases per-handle state (e.g. a partially reassembled SDU) when a CIS or BIS goes away */
+void iso_dhm_remove_handle(uint16_t conn_handle);
+wiced_bool_t iso_dhm_get_handle_stats(uint16_t conn_handle, iso_dhm_handle_stats_t *p_stats);
+wiced_bool_t iso_dhm_get_latency_histogram(uint16_t conn_handle, iso_dhm_latency_hist_t *p_hist);
+
+/* Orders received SDUs by PSN and releases each one to the RX callbacks depth ISO intervals
+ * (PSNs) after it arrived; depth 0 keeps order and loss reporting without adding latency.
+ * Holding depth SDUs uses up to depth + 1 buffers from the handle's quota. depth must be below 8. */
+wiced_bool_t iso_dhm_enable_jitter_buffer(uint16_t conn_handle, uint8_t depth, iso_dhm_lost_psn_cb_t lost_cb);
+/* Releases everything held, in PSN order, and goes back to delivering on arrival */
+void iso_dhm_disable_jitter_buffer(uint16_t conn_handle);
+
+/* Channel multiplexing carries several logical channels' frames in one SDU per interval, so
+ * they share one set of ISO data packets and controller credits. The SDU starts with the frame
+ * count and a 2 byte channel table entry per frame (channel in the top 4 bits, frame length in
+ * the low 12), followed by the frames in table order. */
+/* Packs the frames into p_buf, a data handler buffer. Returns the SDU length, 0 if the frames
+ * do not fit in max_sdu_len or a channel or frame count is out of range. */
+uint32_t iso_dhm_mux_pack(uint8_t *p_buf, const iso_dhm_mux_frame_t *p_frames, uint8_t num_frames);
+/* Packs the frames into a buffer of the handle and sends it like iso_dhm_send_packet */
+wiced_bool_t iso_dhm_send_mux(uint16_t psn, uint16_t conn_handle, uint8_t ts_flag, const iso_dhm_mux_frame_t *p_frames, uint8_t num_frames);
+/* SDUs received on a multiplexed handle are split into frames for the channel callbacks and
+ * no longer reach the RX callbacks; lost or empty SDUs carry no frames. */
+wiced_bool_t iso_dhm_enable_mux(uint16_t conn_handle, wiced_bool_t enable);
+void iso_dhm_register_channel_cb(uint8_t channel, iso_dhm_channel_rx_cb_t channel_cb);
+
+#ifdef ISO_DHM_SHM_DATA_PATH
+/* One SDU in a shared memory ring, written by the producer side only */
+typedef struct
+{
+    uint16_t conn_handle;
+    uint16_t psn;
+    uint32_t ts;                            // time stamp in us, only if ts_valid
+    uint16_t sdu_len;
+    uint8_t ts_valid;
+    uint8_t packet_status;                  // ISO_DHM_PKT_STATUS_xxx, RX only
+    uint8_t sdu[ISO_DHM_SLAB_SDU_SIZE];
+} iso_dhm_shm_slot_t;
+
+/* Single producer / single consumer ring. Only the producer writes head and only the consumer
+ * writes tail, each after the slot it publishes or releases, so neither side needs a lock. */
+typedef struct
+{
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    iso_dhm_shm_slot_t slot[ISO_DHM_SHM_RING_SLOTS];
+} iso_dhm_shm_ring_t;
+
+/* Codec_Configuration for the input (host to controller) or output data path of a handle.
+ * Fills p_csc, ISO_DHM_SHM_CSC_LEN bytes, and returns its length. */
+uint8_t iso_dhm_shm_get_csc(wiced_bool_t input, uint8_t *p_csc);
+/* Once the input data path is set up: SDUs sent on the handle go to the TX ring, one slot per
+ * SDU, with no HCI framing or segmentation. A ring slot counts as one credit, held until
+ * iso_dhm_shm_poll sees the controller took the SDU. */
+wiced_bool_t iso_dhm_shm_enable(uint16_t conn_handle, wiced_bool_t enable);
+/* Reports the SDUs the controller took from the TX ring, as completed packets, and delivers the
+ * SDUs in the RX ring. Call it on the controller's doorbell or periodically, from the BT stack
+ * thread. Returns the number of ring slots processed. Ring traffic is not captured. */
+uint32_t iso_dhm_shm_poll(void);
+#endif
+
+#ifdef ISO_DHM_CAPTURE
+/* Receives the capture as a btsnoop file, piece by piece */
+typedef void (*iso_dhm_capture_write_cb_t)(const uint8_t *p_data, uint32_t len);
+
+/* Starts or pauses capturing; it is off after boot. Captures from the BT stack thread only. */
+void iso_dhm_capture_enable(wiced_bool_t enable);
+void iso_dhm_capture_clear(void);
+/* Writes the captured packets, oldest first, as a btsnoop file (H4 datalink, time stamps in us
+ * since boot) through write_cb. Returns the number of packets written. */
+uint32_t iso_dhm_capture_dump(iso_dhm_capture_write_cb_t write_cb);
+#endif
 #endif /* ISO_DATA_HANDLER_H_ */
@@ -207,6 +207,18 @@ wiced_result_t app_init(void)
     isoc_init();
     led_init();
 
+#ifdef ISOC_BIG_SOURCE
+    // the periodic advertising train of ISOC_BIG_ADV_HANDLE carries the BIGInfo
+    isoc_big_source_start(ISOC_BIG_ADV_HANDLE);
+#endif
+#ifdef ISOC_BIG_SINK
+    // the BIS of the BIG source at ISOC_BIG_SINK_ADV_ADDR are received as well
+    isoc_big_sink_start();
+#endif
+#ifdef ISOC_TEST_MODE
+    isoc_test_mode_init();
+#endif
+
     /* Allow peer to pair */
     wiced_bt_set_pairable_mode(WICED_TRUE, FALSE);
 
@@ -23,6 +23,9 @@
 
 #include "cyabs_rtos_impl.h"
 #include "isoc_peripheral.h"
+#include "isoc_big_source.h"
+#include "isoc_big_sink.h"
+#include "isoc_test_mode.h"
 
 /* Priority for GPIO Button Interrupt */
 #define GPIO_INTERRUPT_PRIORITY     (7u)
@@ -47,7 +47,11 @@ static wiced_bt_cfg_isoc_t cfg_isoc = {
     .max_cis_conn = 1,
     .max_cig_count = 1,
     .max_buffers_per_cis = 4,
+#if defined(ISOC_BIG_SOURCE) || defined(ISOC_BIG_SINK)
+    .max_big_count = 1
+#else
     .max_big_count = 0
+#endif
 };
 
 /* Custom Bluetooth stack configuration */
@@ -337,6 +341,14 @@ static wiced_result_t app_bt_management(wiced_bt_management_evt_t event,
 #endif
             break;
 
+#ifdef ISOC_BIG_SINK
+        case BTM_BLE_PERIODIC_ADV_SYNC_ESTABLISHED_EVENT:
+        case BTM_BLE_PERIODIC_ADV_SYNC_LOST_EVENT:
+        case BTM_BLE_BIGINFO_ADV_REPORT_EVENT:
+            isoc_big_sink_btm_event(event, p_event_data);
+            break;
+#endif
+
         default:
             WICED_BT_TRACE("Unhandled management event: %d!!!", event );
             break;
@@ -0,0 +1,391 @@
+/*
+ * $ Copyright YEAR Cypress Semiconductor $
+ */
+/*
+ * isoc_big_sink.c
+ *
+ * Broadcast Isochronous Group sink: synchronizes to the periodic advertising
+ * train of a BIG source, then to up to ISOC_BIG_SINK_NUM_BIS of its BIS, and
+ * receives their SDUs through the ISO data handler without any ACL or CIS.
+ */
+#ifdef ISOC_BIG_SINK
+
+#include <string.h>
+
+#include "wiced_bt_trace.h"
+#include "wiced_bt_types.h"
+#include "wiced_bt_ble.h"
+#include "iso_data_handler.h"
+#include "isoc_big_sink.h"
+#include "app.h"
+#include  "app_terminal_trace.h"
+
+/******************************************************************************
+ *  defines
+ ******************************************************************************/
+#if ISOC_TRACE
+# define APP_BIG_TRACE                         WICED_BT_TRACE
+#else
+# define APP_BIG_TRACE(...)
+#endif
+
+#define ISOC_BIG_SINK_HANDLE                1
+
+// periodic advertising events that may be skipped, 0 receives every BIGInfo
+#define ISOC_BIG_SINK_PA_SKIP               0
+// periodic advertising sync timeout, in 10 ms units
+#define ISOC_BIG_SINK_PA_SYNC_TIMEOUT       1000
+
+// BIG sync timeout, in 10 ms units
+#define ISOC_BIG_SINK_SYNC_TIMEOUT          100
+// subevents the controller may use to receive each BIS PDU, 0 lets it pick
+#define ISOC_BIG_SINK_MSE                   0
+
+typedef enum
+{
+    ISOC_BIG_SINK_IDLE,
+    ISOC_BIG_SINK_PA_SYNCING,               // scanning for the periodic advertising train
+    ISOC_BIG_SINK_BIGINFO,                  // waiting for the BIGInfo
+    ISOC_BIG_SINK_BIG_SYNCING,              // waiting for the BIG sync to be established
+    ISOC_BIG_SINK_SYNCED,
+} isoc_big_sink_state_t;
+
+/******************************************************************************
+ *  local variables
+ ******************************************************************************/
+static struct
+{
+    isoc_big_sink_state_t state;
+    uint16_t sync_handle;
+    uint8_t num_bis;
+    uint8_t num_data_paths;
+    uint16_t bis_conn_hdl[ISOC_BIG_SINK_NUM_BIS];
+} sink = {0};
+
+/*******************************************************************************
+ * private functions
+ ******************************************************************************/
+static wiced_bool_t isoc_big_sink_is_bis(uint16_t conn_hdl)
+{
+    uint8_t i;
+
+    for (i = 0; i < sink.num_bis; i++)
+    {
+        if (sink.bis_conn_hdl[i] == conn_hdl)
+        {
+            return WICED_TRUE;
+        }
+    }
+    return WICED_FALSE;
+}
+
+static void isoc_big_sink_scan_result_cback(wiced_bt_ble_scan_results_t *p_scan_result,
+                                            uint8_t *p_adv_data)
+{
+    // only the periodic advertising sync is wanted from the scan
+}
+
+/******************************************************************************
+ * Function Name: isoc_big_sink_create_sync
+ ******************************************************************************
+ * Summary:
+ *  Synchronizes to the BIS listed in the BIGInfo, at most ISOC_BIG_SINK_NUM_BIS
+ *****************************************************************************/
+static void isoc_big_sink_create_sync(uint8_t num_bis)
+{
+    wiced_ble_isoc_big_create_sync_t sync_param =
+    {
+        .big_handle = ISOC_BIG_SINK_HANDLE,
+        .sync_handle = sink.sync_handle,
+        .encryption = 0,
+        .mse = ISOC_BIG_SINK_MSE,
+        .big_sync_timeout = ISOC_BIG_SINK_SYNC_TIMEOUT,
+    };
+    wiced_result_t result;
+    uint8_t i;
+
+    sync_param.num_bis = (num_bis < ISOC_BIG_SINK_NUM_BIS) ? num_bis : ISOC_BIG_SINK_NUM_BIS;
+    // BIS indices start at 1
+    for (i = 0; i < sync_param.num_bis; i++)
+    {
+        sync_param.bis_idx_list[i] = i + 1;
+    }
+
+    sink.state = ISOC_BIG_SINK_BIG_SYNCING;
+    result = (wiced_result_t) wiced_ble_isoc_big_create_sync(&sync_param);
+    APP_BIG_TRACE("[%s] sync_handle:0x%x num_bis:%d result:%d", __FUNCTION__,
+                  sink.sync_handle, sync_param.num_bis, result);
+    if (result != WICED_SUCCESS)
+    {
+        sink.state = ISOC_BIG_SINK_BIGINFO;
+    }
+}
+
+/******************************************************************************
+ * Function Name: isoc_big_sink_synced
+ ******************************************************************************
+ * Summary:
+ *  Registers every BIS with the ISO data handler, binds it to rx_handler and
+ *  sets up its HCI output data path
+ *****************************************************************************/
+static void isoc_big_sink_synced(uint8_t num_bis, uint16_t *p_bis_conn_hdl)
+{
+    wiced_ble_isoc_setup_data_path_info_t data_path_info =
+    {
+        .data_path_dir = WICED_BLE_ISOC_DPD_OUTPUT,
+        .data_path_id = WICED_BLE_ISOC_DPID_HCI,
+        .controller_delay = 0,
+        .codec_id = {0,0,0,0,0},
+        .csc_length = 0,
+        .p_csc = NULL,
+        .p_app_ctx = NULL,
+    };
+    wiced_result_t result;
+    uint8_t i;
+
+    sink.state = ISOC_BIG_SINK_SYNCED;
+    sink.num_bis = (num_bis < ISOC_BIG_SINK_NUM_BIS) ? num_bis : ISOC_BIG_SINK_NUM_BIS;
+    sink.num_data_paths = 0;
+
+    // the BIG sync runs on its own, the periodic advertising train is not
+    // needed anymore
+    wiced_bt_ble_terminate_sync_to_periodic_adv(sink.sync_handle);
+
+    for (i = 0; i < sink.num_bis; i++)
+    {
+        sink.bis_conn_hdl[i] = p_bis_conn_hdl[i];
+
+        // nothing is sent on a BIS sink, no buffers are held for it
+        iso_dhm_add_handle(sink.bis_conn_hdl[i], 0);
+        iso_dhm_set_handle_valid(sink.bis_conn_hdl[i], WICED_TRUE);
+        isoc_bind_rx_handler(sink.bis_conn_hdl[i]);
+
+        data_path_info.isoc_conn_hdl = sink.bis_conn_hdl[i];
+        result = (wiced_result_t) wiced_ble_isoc_setup_data_path(&data_path_info);
+        APP_BIG_TRACE("[%s] BIS 0x%x setup_data_path %d", __FUNCTION__,
+                      sink.bis_conn_hdl[i], result);
+        CY_UNUSED_PARAMETER(result);
+    }
+}
+
+/******************************************************************************
+ * Function Name: isoc_big_sink_lost
+ ******************************************************************************
+ * Summary:
+ *  Releases the BIS handles and starts over from the periodic advertising
+ *  sync
+ *****************************************************************************/
+static void isoc_big_sink_lost(void)
+{
+    uint8_t i;
+
+    for (i = 0; i < sink.num_bis; i++)
+    {
+        iso_dhm_set_handle_valid(sink.bis_conn_hdl[i], WICED_FALSE);
+        iso_dhm_remove_handle(sink.bis_conn_hdl[i]);
+    }
+
+    memset(&sink, 0, sizeof(sink));
+    isoc_big_sink_start();
+}
+
+/*******************************************************************************
+ * public functions
+ ******************************************************************************/
+/******************************************************************************
+ * Function Name: isoc_big_sink_start
+ ******************************************************************************
+ * Summary:
+ *  Starts scanning and synchronizing to the periodic advertising train
+ *****************************************************************************/
+wiced_result_t isoc_big_sink_start(void)
+{
+    wiced_bt_device_address_t adv_addr = ISOC_BIG_SINK_ADV_ADDR;
+    wiced_result_t result;
+
+    if (sink.state != ISOC_BIG_SINK_IDLE)
+    {
+        return WICED_ALREADY_INITIALIZED;
+    }
+
+    result = (wiced_result_t) wiced_bt_ble_create_sync_to_periodic_adv(0,
+                        ISOC_BIG_SINK_ADV_SID, adv_addr, ISOC_BIG_SINK_ADV_ADDR_TYPE,
+                        ISOC_BIG_SINK_PA_SKIP, ISOC_BIG_SINK_PA_SYNC_TIMEOUT, 0);
+    APP_BIG_TRACE("[%s] create PA sync %B sid:%d result:%d", __FUNCTION__,
+                  adv_addr, ISOC_BIG_SINK_ADV_SID, result);
+    if (result != WICED_SUCCESS)
+    {
+        return result;
+    }
+
+    // the periodic advertising train is found through the extended advertising
+    sink.state = ISOC_BIG_SINK_PA_SYNCING;
+    wiced_bt_ble_scan(BTM_BLE_SCAN_TYPE_HIGH_DUTY, WICED_FALSE,
+                      isoc_big_sink_scan_result_cback);
+    return WICED_SUCCESS;
+}
+
+/******************************************************************************
+ * Function Name: isoc_big_sink_stop
+ ******************************************************************************
+ * Summary:
+ *  Terminates the BIG sync, or the sync attempt
+ *****************************************************************************/
+void isoc_big_sink_stop(void)
+{
+    uint8_t i;
+
+    switch (sink.state)
+    {
+    case ISOC_BIG_SINK_PA_SYNCING:
+        wiced_bt_ble_scan(BTM_BLE_SCAN_TYPE_NONE, WICED_FALSE, NULL);
+        wiced_bt_ble_cancel_sync_to_periodic_adv();
+        break;
+    case ISOC_BIG_SINK_BIGINFO:
+        wiced_bt_ble_terminate_sync_to_periodic_adv(sink.sync_handle);
+        break;
+    case ISOC_BIG_SINK_BIG_SYNCING:
+    case ISOC_BIG_SINK_SYNCED:
+        wiced_ble_isoc_big_terminate_sync(ISOC_BIG_SINK_HANDLE);
+        for (i = 0; i < sink.num_bis; i++)
+        {
+            iso_dhm_set_handle_valid(sink.bis_conn_hdl[i], WICED_FALSE);
+            iso_dhm_remove_handle(sink.bis_conn_hdl[i]);
+        }
+        break;
+    default:
+        break;
+    }
+
+    memset(&sink, 0, sizeof(sink));
+}
+
+/******************************************************************************
+ * Function Name: isoc_big_sink_btm_event
+ ******************************************************************************
+ * Summary:
+ *  Handles the periodic advertising sync and its BIGInfo reports
+ *****************************************************************************/
+void isoc_big_sink_btm_event(wiced_bt_management_evt_t event,
+                             wiced_bt_management_evt_data_t *p_event_data)
+{
+    switch (event)
+    {
+    case BTM_BLE_PERIODIC_ADV_SYNC_ESTABLISHED_EVENT:
+        APP_BIG_TRACE("[%s] PA sync established status:%d sync_handle:0x%x",
+                      __FUNCTION__,
+                      p_event_data->ble_periodic_adv_sync_established_event.status,
+                      p_event_data->ble_periodic_adv_sync_established_event.sync_handle);
+        if (sink.state != ISOC_BIG_SINK_PA_SYNCING)
+        {
+            break;
+        }
+        wiced_bt_ble_scan(BTM_BLE_SCAN_TYPE_NONE, WICED_FALSE, NULL);
+        if (WICED_BT_SUCCESS != p_event_data->ble_periodic_adv_sync_established_event.status)
+        {
+            sink.state = ISOC_BIG_SINK_IDLE;
+            isoc_big_sink_start();
+            break;
+        }
+        sink.sync_handle = p_event_data->ble_periodic_adv_sync_established_event.sync_handle;
+        sink.state = ISOC_BIG_SINK_BIGINFO;
+        break;
+
+    case BTM_BLE_BIGINFO_ADV_REPORT_EVENT:
+        if ((sink.state != ISOC_BIG_SINK_BIGINFO)
+            || (p_event_data->ble_biginfo_adv_report_event.sync_handle != sink.sync_handle))
+        {
+            break;
+        }
+        if (p_event_data->ble_biginfo_adv_report_event.encryption)
+        {
+            // there is no Broadcast_Code to decrypt it with
+            APP_BIG_TRACE("[%s] encrypted BIG, not synchronized", __FUNCTION__);
+            break;
+        }
+        isoc_big_sink_create_sync(p_event_data->ble_biginfo_adv_report_event.num_bis);
+        break;
+
+    case BTM_BLE_PERIODIC_ADV_SYNC_LOST_EVENT:
+        APP_BIG_TRACE("[%s] PA sync lost sync_handle:0x%x", __FUNCTION__,
+                      p_event_data->ble_periodic_adv_sync_lost_event.sync_handle);
+        // a BIG sync that is up does not need the periodic advertising train
+        if ((sink.state == ISOC_BIG_SINK_BIGINFO)
+            && (p_event_data->ble_periodic_adv_sync_lost_event.sync_handle == sink.sync_handle))
+        {
+            sink.state = ISOC_BIG_SINK_IDLE;
+            isoc_big_sink_start();
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+/******************************************************************************
+ * Function Name: isoc_big_sink_event
+ ******************************************************************************
+ * Summary:
+ *  Handles BIG sync established / lost and the BIS data path events
+ *****************************************************************************/
+wiced_bool_t isoc_big_sink_event(wiced_ble_isoc_event_t event,
+                                 wiced_ble_isoc_event_data_t *p_event_data)
+{
+    switch (event)
+    {
+    case WICED_BLE_ISOC_BIG_SYNC_ESTABLISHED_EVT:
+        APP_BIG_TRACE("[%s] BIG sync established status:%d big_handle:%d num_bis:%d",
+                      __FUNCTION__, p_event_data->big_sync_established.status,
+                      p_event_data->big_sync_established.big_handle,
+                      p_event_data->big_sync_established.num_bis);
+        if (WICED_BT_SUCCESS == p_event_data->big_sync_established.status)
+        {
+            isoc_big_sink_synced(p_event_data->big_sync_established.num_bis,
+                                 p_event_data->big_sync_established.bis_conn_hdl_list);
+        }
+        else
+        {
+            // the next BIGInfo retries
+            sink.state = ISOC_BIG_SINK_BIGINFO;
+        }
+        return WICED_TRUE;
+
+    case WICED_BLE_ISOC_BIG_SYNC_LOST_EVT:
+        APP_BIG_TRACE("[%s] BIG sync lost big_handle:%d reason:%d",
+                      __FUNCTION__, p_event_data->big_sync_lost.big_handle,
+                      p_event_data->big_sync_lost.reason);
+        isoc_big_sink_lost();
+        return WICED_TRUE;
+
+    case WICED_BLE_ISOC_DATA_PATH_SETUP_EVT:
+        if (!isoc_big_sink_is_bis(p_event_data->datapath.conn_hdl))
+        {
+            return WICED_FALSE;
+        }
+        if (WICED_BT_SUCCESS == p_event_data->datapath.status)
+        {
+            if (++sink.num_data_paths == sink.num_bis)
+            {
+                APP_BIG_TRACE("[%s] receiving on %d BIS", __FUNCTION__, sink.num_bis);
+            }
+        }
+        else
+        {
+            APP_BIG_TRACE("[%s] BIS 0x%x data path failure, status: %d",
+                          __FUNCTION__, p_event_data->datapath.conn_hdl,
+                          p_event_data->datapath.status);
+        }
+        return WICED_TRUE;
+
+    case WICED_BLE_ISOC_DATA_PATH_REMOVED_EVT:
+        return isoc_big_sink_is_bis(p_event_data->datapath.conn_hdl);
+
+    default:
+        return WICED_FALSE;
+    }
+}
+
+#endif // ISOC_BIG_SINK
+
+/* [] END OF FILE */
@@ -0,0 +1,61 @@
+/*
+ * $ Copyright YEAR Cypress Semiconductor $
+ */
+/*
+ * @file isoc_big_sink.h
+ *
+ * @brief API for the Broadcast Isochronous Group (BIG) sink mode. Built
+ *        only with ISOC_BIG_SINK defined (make BIG_SINK=1).
+ */
+#ifndef ISOC_BIG_SINK_H_
+#define ISOC_BIG_SINK_H_
+
+#include "wiced_bt_dev.h"
+#include "wiced_bt_isoc.h"
+
+#ifdef ISOC_BIG_SINK
+
+// most BIS synchronized to, the first ones of the BIG are picked
+#ifndef ISOC_BIG_SINK_NUM_BIS
+#define ISOC_BIG_SINK_NUM_BIS               2
+#endif
+
+// advertiser whose periodic advertising train carries the BIGInfo. The
+// default is a placeholder: for a board built with BIG_SOURCE=1, set the
+// address and SID it traces at start ("BIG source adv addr ... SID ...",
+// the SID is its ISOC_BIG_ADV_SID)
+#ifndef ISOC_BIG_SINK_ADV_ADDR
+#define ISOC_BIG_SINK_ADV_ADDR              {0x00, 0xA0, 0x50, 0x00, 0x00, 0x01}
+#endif
+#ifndef ISOC_BIG_SINK_ADV_ADDR_TYPE
+#define ISOC_BIG_SINK_ADV_ADDR_TYPE         BLE_ADDR_PUBLIC
+#endif
+#ifndef ISOC_BIG_SINK_ADV_SID
+#define ISOC_BIG_SINK_ADV_SID               1
+#endif
+
+/*
+ * Scans for and synchronizes to the periodic advertising train of
+ * ISOC_BIG_SINK_ADV_ADDR. The BIG is synchronized to once its BIGInfo is
+ * received and HCI output data paths are set up on each BIS; the SDUs are
+ * delivered to the rx_handler of isoc_peripheral.
+ */
+wiced_result_t isoc_big_sink_start(void);
+
+/* Terminates the BIG sync, or the sync attempt */
+void isoc_big_sink_stop(void);
+
+/* Periodic advertising sync and BIGInfo events from the BT management
+ * callback */
+void isoc_big_sink_btm_event(wiced_bt_management_evt_t event,
+                             wiced_bt_management_evt_data_t *p_event_data);
+
+/* ISOC management events for the BIG; returns WICED_TRUE if consumed */
+wiced_bool_t isoc_big_sink_event(wiced_ble_isoc_event_t event,
+                                 wiced_ble_isoc_event_data_t *p_event_data);
+
+#endif // ISOC_BIG_SINK
+
+#endif // ISOC_BIG_SINK_H_
+
+/* [] END OF FILE */
@@ -0,0 +1,400 @@
+/*
+ * $ Copyright YEAR Cypress Semiconductor $
+ */
+/*
+ * isoc_big_source.c
+ *
+ * Broadcast Isochronous Group source: one BIG with ISOC_BIG_NUM_BIS BIS,
+ * each fed the same SDUs through the ISO data handler.
+ */
+#ifdef ISOC_BIG_SOURCE
+
+#include <string.h>
+
+#include "wiced_bt_trace.h"
+#include "wiced_bt_types.h"
+#include "wiced_bt_ble.h"
+#include "wiced_bt_dev.h"
+#include "iso_data_handler.h"
+#include "isoc_big_source.h"
+#include "app.h"
+#include  "app_terminal_trace.h"
+
+/******************************************************************************
+ *  defines
+ ******************************************************************************/
+#if ISOC_TRACE
+# define APP_BIG_TRACE                         WICED_BT_TRACE
+#else
+# define APP_BIG_TRACE(...)
+#endif
+
+#define ISOC_BIG_HANDLE                     1
+
+// sdu interval in micro-second, same as the CIS
+#define ISOC_BIG_SDU_INTERVAL               10000
+// max transport latency in milli-second
+#define ISOC_BIG_MAX_TRANSPORT_LATENCY      20
+// each BIS PDU is sent this many extra times, there are no acks
+#define ISOC_BIG_RTN                        2
+
+// primary (extended) advertising interval, in 0.625 ms units
+#define ISOC_BIG_EXT_ADV_INTERVAL           160
+// periodic advertising interval, in 1.25 ms units
+#define ISOC_BIG_PERIODIC_ADV_INTERVAL      80
+
+// HCI reason for terminating the BIG
+#define ISOC_BIG_TERMINATE_REASON           0x16
+
+/******************************************************************************
+ *  local variables
+ ******************************************************************************/
+static struct
+{
+    wiced_bool_t created;
+    uint8_t num_bis;
+    uint8_t num_data_paths;
+    uint16_t bis_conn_hdl[ISOC_BIG_NUM_BIS];
+    uint16_t psn;
+    uint32_t tx_count;
+    uint32_t tx_dropped;
+} big = {0};
+
+// AD of the extended advertising, the name lets a scanner tell the source apart
+static uint8_t isoc_big_ext_adv_data[] =
+{
+    10, BTM_BLE_ADVERT_TYPE_NAME_COMPLETE,
+    'I', 'S', 'O', 'C', ' ', 'B', 'I', 'G', 'S',
+};
+
+/*******************************************************************************
+ * private functions
+ ******************************************************************************/
+static wiced_bool_t isoc_big_source_is_bis(uint16_t conn_hdl)
+{
+    uint8_t i;
+
+    for (i = 0; i < big.num_bis; i++)
+    {
+        if (big.bis_conn_hdl[i] == conn_hdl)
+        {
+            return WICED_TRUE;
+        }
+    }
+    return WICED_FALSE;
+}
+
+/******************************************************************************
+ * Function Name: isoc_big_source_start_adv
+ ******************************************************************************
+ * Summary:
+ *  Sets up and enables the non-connectable extended advertising set
+ *  adv_handle and its periodic advertising train, which Create BIG needs to
+ *  put the BIGInfo in. The stack sends the HCI commands in order, so the
+ *  BIG can be created right after.
+ *****************************************************************************/
+static wiced_result_t isoc_big_source_start_adv(uint8_t adv_handle)
+{
+    wiced_bt_ble_ext_adv_duration_config_t duration =
+    {
+        .adv_handle = adv_handle,
+        .adv_duration = 0,          // until disabled
+        .max_ext_adv_events = 0,
+    };
+    wiced_bt_device_address_t peer_addr = {0};
+    wiced_bt_device_address_t local_addr;
+    wiced_result_t result;
+
+    // non-connectable, non-scannable, undirected: the only kind that may
+    // have a periodic advertising train
+    result = wiced_bt_ble_set_ext_adv_parameters(adv_handle, 0,
+                                                 ISOC_BIG_EXT_ADV_INTERVAL,
+                                                 ISOC_BIG_EXT_ADV_INTERVAL,
+                                                 BTM_BLE_DEFAULT_ADVERT_CHNL_MAP,
+                                                 BLE_ADDR_PUBLIC, BLE_ADDR_PUBLIC,
+                                                 peer_addr,
+                                                 BTM_BLE_ADV_POLICY_ACCEPT_CONN_AND_SCAN,
+                                                 127, // no preference
+                                                 WICED_BT_BLE_EXT_ADV_PHY_1M, 0,
+                                                 WICED_BT_BLE_EXT_ADV_PHY_2M,
+                                                 ISOC_BIG_ADV_SID,
+                                                 WICED_BT_BLE_EXT_ADV_SCAN_REQ_NOTIFY_DISABLE);
+    if (WICED_BT_SUCCESS != result)
+    {
+        APP_BIG_TRACE("[%s] set_ext_adv_parameters %d", __FUNCTION__, result);
+        return result;
+    }
+
+    result = wiced_bt_ble_set_ext_adv_data(adv_handle, sizeof(isoc_big_ext_adv_data),
+                                           isoc_big_ext_adv_data);
+    if (WICED_BT_SUCCESS != result)
+    {
+        APP_BIG_TRACE("[%s] set_ext_adv_data %d", __FUNCTION__, result);
+        return result;
+    }
+
+    // the train carries no AD of its own, only the BIGInfo once the BIG exists
+    result = wiced_bt_ble_set_periodic_adv_params(adv_handle,
+                                                  ISOC_BIG_PERIODIC_ADV_INTERVAL,
+                                                  ISOC_BIG_PERIODIC_ADV_INTERVAL, 0);
+    if (WICED_BT_SUCCESS != result)
+    {
+        APP_BIG_TRACE("[%s] set_periodic_adv_params %d", __FUNCTION__, result);
+        return result;
+    }
+
+    result = wiced_bt_ble_set_periodic_adv_data(adv_handle, 0, NULL);
+    if (WICED_BT_SUCCESS != result)
+    {
+        APP_BIG_TRACE("[%s] set_periodic_adv_data %d", __FUNCTION__, result);
+        return result;
+    }
+
+    result = wiced_bt_ble_start_periodic_adv(adv_handle, WICED_TRUE);
+    if (WICED_BT_SUCCESS != result)
+    {
+        APP_BIG_TRACE("[%s] start_periodic_adv %d", __FUNCTION__, result);
+        return result;
+    }
+
+    result = wiced_bt_ble_start_ext_adv(WICED_TRUE, 1, &duration);
+    if (WICED_BT_SUCCESS != result)
+    {
+        APP_BIG_TRACE("[%s] start_ext_adv %d", __FUNCTION__, result);
+        return result;
+    }
+
+    // a BIG sink needs these as ISOC_BIG_SINK_ADV_ADDR / ISOC_BIG_SINK_ADV_SID
+    wiced_bt_dev_read_local_addr(local_addr);
+    WICED_BT_TRACE("BIG source adv addr %B (public) SID %d", local_addr, ISOC_BIG_ADV_SID);
+    return WICED_BT_SUCCESS;
+}
+
+/******************************************************************************
+ * Function Name: isoc_big_source_created
+ ******************************************************************************
+ * Summary:
+ *  Registers every BIS with the ISO data handler and sets up its HCI input
+ *  data path
+ *****************************************************************************/
+static void isoc_big_source_created(uint8_t num_bis, uint16_t *p_bis_conn_hdl)
+{
+    wiced_ble_isoc_setup_data_path_info_t data_path_info =
+    {
+        .data_path_dir = WICED_BLE_ISOC_DPD_INPUT,
+        .data_path_id = WICED_BLE_ISOC_DPID_HCI,
+        .controller_delay = 0,
+        .codec_id = {0,0,0,0,0},
+        .csc_length = 0,
+        .p_csc = NULL,
+        .p_app_ctx = NULL,
+    };
+    wiced_result_t result;
+    uint8_t i;
+
+    big.created = WICED_TRUE;
+    big.num_bis = (num_bis < ISOC_BIG_NUM_BIS) ? num_bis : ISOC_BIG_NUM_BIS;
+    big.num_data_paths = 0;
+    big.psn = 0;
+
+    for (i = 0; i < big.num_bis; i++)
+    {
+        big.bis_conn_hdl[i] = p_bis_conn_hdl[i];
+
+        // SDUs go out one at a time, no buffers need to be held per BIS
+        iso_dhm_add_handle(big.bis_conn_hdl[i], 0);
+        iso_dhm_set_handle_valid(big.bis_conn_hdl[i], WICED_TRUE);
+
+        data_path_info.isoc_conn_hdl = big.bis_conn_hdl[i];
+        result = (wiced_result_t) wiced_ble_isoc_setup_data_path(&data_path_info);
+        APP_BIG_TRACE("[%s] BIS 0x%x setup_data_path %d", __FUNCTION__,
+                      big.bis_conn_hdl[i], result);
+        CY_UNUSED_PARAMETER(result);
+    }
+}
+
+/******************************************************************************
+ * Function Name: isoc_big_source_terminated
+ ******************************************************************************
+ * Summary:
+ *  Releases the BIS handles
+ *****************************************************************************/
+static void isoc_big_source_terminated(void)
+{
+    uint8_t i;
+
+    for (i = 0; i < big.num_bis; i++)
+    {
+        iso_dhm_set_handle_valid(big.bis_conn_hdl[i], WICED_FALSE);
+        iso_dhm_remove_handle(big.bis_conn_hdl[i]);
+    }
+
+    APP_BIG_TRACE("[%s] tx_count:%d tx_dropped:%d", __FUNCTION__,
+                  (int)big.tx_count, (int)big.tx_dropped);
+
+    memset(&big, 0, sizeof(big));
+}
+
+/*******************************************************************************
+ * public functions
+ ******************************************************************************/
+/******************************************************************************
+ * Function Name: isoc_big_source_start
+ ******************************************************************************
+ * Summary:
+ *  Starts the periodic advertising train of adv_handle and creates the BIG
+ *****************************************************************************/
+wiced_result_t isoc_big_source_start(uint8_t adv_handle)
+{
+    wiced_ble_isoc_create_big_param_t big_param =
+    {
+        .big_handle = ISOC_BIG_HANDLE,
+        .adv_handle = adv_handle,
+        .num_bis = ISOC_BIG_NUM_BIS,
+        .sdu_interval = ISOC_BIG_SDU_INTERVAL,
+        .max_sdu = ISO_SDU_SIZE,
+        .max_transport_latency = ISOC_BIG_MAX_TRANSPORT_LATENCY,
+        .rtn = ISOC_BIG_RTN,
+        .phy = WICED_BLE_ISOC_LE_2M_PHY,
+        .packing = WICED_BLE_ISOC_SEQUENTIAL_PACKING,
+        .framing = WICED_BLE_ISOC_UNFRAMED,
+        .encryption = 0,
+    };
+    wiced_result_t result;
+
+    if (big.created)
+    {
+        return WICED_ALREADY_INITIALIZED;
+    }
+
+    result = isoc_big_source_start_adv(adv_handle);
+    if (WICED_BT_SUCCESS != result)
+    {
+        return result;
+    }
+
+    result = (wiced_result_t) wiced_ble_isoc_create_big(&big_param);
+    APP_BIG_TRACE("[%s] adv_handle:%d num_bis:%d result:%d", __FUNCTION__,
+                  adv_handle, ISOC_BIG_NUM_BIS, result);
+    return result;
+}
+
+/******************************************************************************
+ * Function Name: isoc_big_source_stop
+ ******************************************************************************
+ * Summary:
+ *  Terminates the BIG, isoc_big_source_event cleans up on BIG terminated
+ *****************************************************************************/
+void isoc_big_source_stop(void)
+{
+    if (big.created)
+    {
+        wiced_ble_isoc_terminate_big(ISOC_BIG_HANDLE, ISOC_BIG_TERMINATE_REASON);
+    }
+}
+
+/******************************************************************************
+ * Function Name: isoc_big_source_ready
+ ******************************************************************************
+ * Summary:
+ *  Returns TRUE once SDUs can be sent on every BIS
+ *****************************************************************************/
+CY_SECTION_RAMFUNC_BEGIN
+wiced_bool_t isoc_big_source_ready(void)
+{
+    return big.created && big.num_bis && (big.num_data_paths == big.num_bis);
+}
+CY_SECTION_RAMFUNC_END
+
+/******************************************************************************
+ * Function Name: isoc_big_source_send
+ ******************************************************************************
+ * Summary:
+ *  Sends the SDU on every BIS from a single data handler buffer. A BIS
+ *  the controller has no credits for misses this SDU; the PSN advances
+ *  regardless so all BIS stay aligned.
+ *****************************************************************************/
+CY_SECTION_RAMFUNC_BEGIN
+uint8_t isoc_big_source_send(const uint8_t *p_data, uint16_t length)
+{
+    uint8_t *p_buf;
+    uint8_t sent = 0;
+
+    if (!isoc_big_source_ready())
+    {
+        return 0;
+    }
+
+    // one copy of the SDU serves every BIS
+    if ((p_buf = iso_dhm_get_data_buffer_for_handle(big.bis_conn_hdl[0])) != NULL)
+    {
+        memcpy(p_buf, p_data, length);
+        sent = iso_dhm_send_packet_fanout(big.psn, big.bis_conn_hdl, big.num_bis,
+                                          WICED_FALSE, p_buf, length);
+    }
+    big.tx_dropped += big.num_bis - sent;
+
+    big.psn++;
+    big.tx_count += sent;
+    return sent;
+}
+CY_SECTION_RAMFUNC_END
+
+/******************************************************************************
+ * Function Name: isoc_big_source_event
+ ******************************************************************************
+ * Summary:
+ *  Handles BIG created / terminated and the BIS data path events
+ *****************************************************************************/
+wiced_bool_t isoc_big_source_event(wiced_ble_isoc_event_t event,
+                                   wiced_ble_isoc_event_data_t *p_event_data)
+{
+    switch (event)
+    {
+    case WICED_BLE_ISOC_BIG_CREATED_EVT:
+        APP_BIG_TRACE("[%s] BIG created status:%d big_handle:%d num_bis:%d",
+                      __FUNCTION__, p_event_data->big_created.status,
+                      p_event_data->big_created.big_handle,
+                      p_event_data->big_created.num_bis);
+        if (WICED_BT_SUCCESS == p_event_data->big_created.status)
+        {
+            isoc_big_source_created(p_event_data->big_created.num_bis,
+                                    p_event_data->big_created.bis_conn_hdl_list);
+        }
+        return WICED_TRUE;
+
+    case WICED_BLE_ISOC_BIG_TERMINATED_EVT:
+        APP_BIG_TRACE("[%s] BIG terminated big_handle:%d reason:%d",
+                      __FUNCTION__, p_event_data->big_terminated.big_handle,
+                      p_event_data->big_terminated.reason);
+        isoc_big_source_terminated();
+        return WICED_TRUE;
+
+    case WICED_BLE_ISOC_DATA_PATH_SETUP_EVT:
+        if (!isoc_big_source_is_bis(p_event_data->datapath.conn_hdl))
+        {
+            return WICED_FALSE;
+        }
+        if (WICED_BT_SUCCESS == p_event_data->datapath.status)
+        {
+            big.num_data_paths++;
+        }
+        else
+        {
+            APP_BIG_TRACE("[%s] BIS 0x%x data path failure, status: %d",
+                          __FUNCTION__, p_event_data->datapath.conn_hdl,
+                          p_event_data->datapath.status);
+        }
+        return WICED_TRUE;
+
+    case WICED_BLE_ISOC_DATA_PATH_REMOVED_EVT:
+        return isoc_big_source_is_bis(p_event_data->datapath.conn_hdl);
+
+    default:
+        return WICED_FALSE;
+    }
+}
+
+#endif // ISOC_BIG_SOURCE
+
+/* [] END OF FILE */
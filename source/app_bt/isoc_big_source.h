@@ -0,0 +1,58 @@
+/*
+ * $ Copyright YEAR Cypress Semiconductor $
+ */
+/*
+ * @file isoc_big_source.h
+ *
+ * @brief API for the Broadcast Isochronous Group (BIG) source mode. Built
+ *        only with ISOC_BIG_SOURCE defined (make BIG_SOURCE=1).
+ */
+#ifndef ISOC_BIG_SOURCE_H_
+#define ISOC_BIG_SOURCE_H_
+
+#include "wiced_bt_isoc.h"
+
+#ifdef ISOC_BIG_SOURCE
+
+// number of BIS in the BIG, every BIS carries the same SDUs
+#ifndef ISOC_BIG_NUM_BIS
+#define ISOC_BIG_NUM_BIS                    2
+#endif
+
+// advertising set whose periodic advertising train carries the BIGInfo
+#ifndef ISOC_BIG_ADV_HANDLE
+#define ISOC_BIG_ADV_HANDLE                 1
+#endif
+
+// advertising SID of that set, a BIG sink syncs to it by address and SID
+#ifndef ISOC_BIG_ADV_SID
+#define ISOC_BIG_ADV_SID                    1
+#endif
+
+/*
+ * Sets up and starts extended advertising with a periodic advertising train
+ * on adv_handle (SID ISOC_BIG_ADV_SID) and creates the BIG on it. The local
+ * address and SID are traced for configuring a BIG sink. HCI input data
+ * paths are set up on each BIS once the BIG is created.
+ */
+wiced_result_t isoc_big_source_start(uint8_t adv_handle);
+
+/* Terminates the BIG */
+void isoc_big_source_stop(void);
+
+/* WICED_TRUE once the BIG exists and every BIS has its input data path */
+wiced_bool_t isoc_big_source_ready(void);
+
+/* Sends one SDU on every BIS, all with the same PSN. Returns the number of
+ * BIS it was handed to the controller on. */
+uint8_t isoc_big_source_send(const uint8_t *p_data, uint16_t length);
+
+/* ISOC management events for the BIG; returns WICED_TRUE if consumed */
+wiced_bool_t isoc_big_source_event(wiced_ble_isoc_event_t event,
+                                   wiced_ble_isoc_event_data_t *p_event_data);
+
+#endif // ISOC_BIG_SOURCE
+
+#endif // ISOC_BIG_SOURCE_H_
+
+/* [] END OF FILE */
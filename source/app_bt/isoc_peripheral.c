@@ -9,6 +9,7 @@
 #include "wiced_bt_types.h"
 #include "wiced_timer.h"
 #include "wiced_memory.h"
+#include "wiced_bt_stack_platform.h"
 #include "iso_data_handler.h"
 #include "cyhal.h"
 #include "app.h"
@@ -31,6 +32,38 @@
 #define ISO_SDU_INTERVAL                    10000
 
 #define ISOC_TIMEOUT_IN_MSECONDS            (ISO_SDU_INTERVAL / 1000)
+
+// SDUs submitted per button transition, each with its own PSN
+#define ISOC_MAX_BURST_COUNT                1
+
+// ISO SDU buffers reserved for the CIS, the rest of the pool is shared
+#define ISOC_RESERVED_SDU_BUFS              2
+
+// with ISOC_TX_TS (make TX_TS=1) SDUs carry a time stamp anchored to the
+// controller time base (TX sync), so each one goes out in the ISO event of
+// its PSN instead of the next free one
+#ifdef ISOC_TX_TS
+#define ISOC_TX_TS_FLAG                     WICED_TRUE
+#else
+#define ISOC_TX_TS_FLAG                     WICED_FALSE
+#endif
+
+// button transitions queued for the BT stack thread, must be a power of 2
+#define ISOC_TX_QUEUE_SIZE                  8
+
+#ifdef ISO_DHM_SHM_DATA_PATH
+// how often the shared memory rings are checked for completed and received SDUs
+#define ISOC_SHM_POLL_INTERVAL_IN_MSECONDS  1
+#endif
+
+#ifdef ISO_DHM_CAPTURE
+// bytes of the btsnoop capture per trace line when it is dumped
+#define ISOC_CAPTURE_LINE_BYTES             32
+#endif
+
+// received SDUs are held this many SDU intervals to reorder them by PSN,
+// 0 keeps PSN order and loss detection without adding latency
+#define ISOC_RX_JITTER_BUFFER_DEPTH         0
 //4 minute keep alive timer to ensure app and controller psn
 #define ISOC_KEEP_ALIVE_TIMEOUT_IN_SECONDS  120
                                                    // stays synchronized
@@ -57,6 +90,48 @@ typedef struct
 #pragma pack()
 #endif
 
+// LE Read ISO Link Quality counters of the CIS sampled periodically, they
+// tell why SDUs are dropped (flushed, CRC errors, missed subevents...)
+#define ISOC_MONITOR_LINK_QUALITY
+#ifdef ISOC_MONITOR_LINK_QUALITY
+#define HCI_LE_READ_ISO_LINK_QUALITY_OPCODE 0x2075
+
+#ifndef ISOC_LINK_QUALITY_INTERVAL_IN_MSECONDS
+#define ISOC_LINK_QUALITY_INTERVAL_IN_MSECONDS  1000
+#endif
+
+// samples kept in the ring, must be a power of 2
+#define ISOC_LINK_QUALITY_HISTORY           16
+
+#pragma pack(1)
+typedef struct
+{
+    uint8_t   status;
+    uint16_t  connHandle;
+    uint32_t  tx_unacked_packets;
+    uint32_t  tx_flushed_packets;
+    uint32_t  tx_last_subevent_packets;
+    uint32_t  retransmitted_packets;
+    uint32_t  crc_error_packets;
+    uint32_t  rx_unreceived_packets;
+    uint32_t  duplicate_packets;
+} isoc_link_quality_evt_t;
+#pragma pack()
+
+// counters are cumulative since the CIS was established
+typedef struct
+{
+    uint32_t  ts_ms;
+    uint32_t  tx_unacked_packets;
+    uint32_t  tx_flushed_packets;
+    uint32_t  tx_last_subevent_packets;
+    uint32_t  retransmitted_packets;
+    uint32_t  crc_error_packets;
+    uint32_t  rx_unreceived_packets;
+    uint32_t  duplicate_packets;
+} isoc_link_quality_sample_t;
+#endif
+
 /******************************************************************************
  *  local variables
  ******************************************************************************/
@@ -76,30 +151,78 @@ static struct
     uint16_t max_payload;
     wiced_ble_isoc_cis_established_evt_t  cis_established_data;
     wiced_timer_t isoc_keep_alive_timer;
+#ifdef ISOC_MONITOR_LINK_QUALITY
+    wiced_timer_t isoc_link_quality_timer;
+#endif
+#ifdef ISO_DHM_SHM_DATA_PATH
+    wiced_timer_t isoc_shm_poll_timer;
+    wiced_bool_t shm_fallback;              // the controller refused the shared memory data path
+#endif
 } isoc = {0};
 
-static wiced_bool_t pressed_saved;
+/*
+ * Single producer (Button Task) / single consumer (BT stack thread) ring of
+ * button transitions. Only the producer writes head and only the consumer
+ * writes tail, so neither side needs a lock; each index is written after
+ * the entry it publishes or releases.
+ */
+typedef struct
+{
+    uint8_t button_state;
+} isoc_tx_sdu_desc_t;
+
+static struct
+{
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    uint32_t dropped;
+    isoc_tx_sdu_desc_t desc[ISOC_TX_QUEUE_SIZE];
+} isoc_tx_queue;
+
+// set by the producer when it serializes isoc_tx_kick, cleared by isoc_tx_kick,
+// so at most one kick is waiting in the stack thread's queue
+static volatile uint8_t isoc_tx_kick_pending;
+
+// only used in the BT stack thread
 static uint16_t sequence = 0;
 
-#define CONTROLLER_ISO_DATA_PACKET_BUFS   6
-static uint8_t number_of_iso_data_packet_bufs = CONTROLLER_ISO_DATA_PACKET_BUFS;
+// controller ISO data packet bufs, as reported by LE Read Buffer Size v2
+#define CONTROLLER_ISO_DATA_PACKET_BUFS \
+    (iso_dhm_get_buffer_info()->total_num_iso_data_packets)
 
 static uint32_t isoc_rx_count = 0;
 static uint32_t isoc_tx_count = 0;
+static uint32_t isoc_rx_lost_count = 0;
 wiced_timer_t iso_stats_timer;
 wiced_ble_isoc_data_path_direction_t dp_dir;
 static void isoc_send_data_handler(void);
 
+#ifdef ISOC_MONITOR_LINK_QUALITY
+// time series of the link quality samples, only used in the BT stack thread
+static struct
+{
+    uint32_t count;                         // samples taken, the newest is count - 1
+    isoc_link_quality_sample_t sample[ISOC_LINK_QUALITY_HISTORY];
+} isoc_link_quality;
+#endif
+
 /*******************************************************************************
  * private functions
  ******************************************************************************/
 static void isoc_send_null_payload(void);
 static void isoc_get_psn_start( WICED_TIMER_PARAM_TYPE param );
+static void rx_handler(void *p_ctx, const iso_dhm_rx_meta_t *p_meta, uint8_t *p_data);
+static void rx_lost_handler(uint16_t cis_handle, uint16_t psn);
+#if defined(ISOC_MONITOR_LINK_QUALITY) && defined(ISOC_STATS)
+static void isoc_link_quality_report(void);
+#endif
 
 void app_send_dummy(uint16_t handle)
 {
-    uint8_t* p_buf = iso_dhm_get_data_buffer();
-    iso_dhm_send_packet(sequence, handle, WICED_FALSE, p_buf, 0);
+    uint8_t* p_buf = iso_dhm_get_data_buffer_for_handle(handle);
+
+    if (p_buf)
+        iso_dhm_send_packet(sequence, handle, WICED_FALSE, p_buf, 0);
 }
 #define  VSC_0XFDFA
 #ifdef VSC_0XFDFA
@@ -133,6 +256,10 @@ static void read_psn_cb(wiced_bt_dev_vendor_specific_command_complete_params_t
         return;
     }
 
+    // SDU synchronization reference of packetSeqNum, later PSNs follow every SDU interval
+    iso_dhm_set_tx_time_base(evt->connHandle, evt->packetSeqNum,
+                             evt->timeStamp + toffset, ISO_SDU_INTERVAL);
+
     // If initial transmission, no need to increment
     if( evt->packetSeqNum == 0 )
         sequence = evt->packetSeqNum;
@@ -191,6 +318,11 @@ static void isoc_read_tx_sync_complete_cback(
         return;
     }
 
+    // SDU synchronization reference of psn, later PSNs follow every SDU interval
+    iso_dhm_set_tx_time_base(p_event_data->conn_hdl, p_event_data->psn,
+                             p_event_data->tx_timestamp + p_event_data->time_offset,
+                             ISO_SDU_INTERVAL);
+
     // If initial transmission, no need to increment
     if( p_event_data->psn == 0 )
         sequence = p_event_data->psn;
@@ -219,11 +351,12 @@ static void isoc_send_null_payload(void)
     uint8_t* p_buf = NULL;
 
     // Allocate buffer for ISOC header
-    if((p_buf = iso_dhm_get_data_buffer()) != NULL)
+    if((p_buf = iso_dhm_get_data_buffer_for_handle(
+            isoc.cis_established_data.cis.cis_conn_handle)) != NULL)
     {
         result = iso_dhm_send_packet(sequence,
                                      isoc.cis_established_data.cis.cis_conn_handle,
-                                     WICED_FALSE, p_buf, 0);
+                                     ISOC_TX_TS_FLAG, p_buf, 0);
 
         APP_ISOC_TRACE("[%s] sent null payload handle %02x result %d",
                        __FUNCTION__, isoc.cis_established_data.cis.cis_conn_handle,
@@ -237,63 +370,200 @@ CY_SECTION_RAMFUNC_END
  * Function Name: isoc_send_data_handler
  *******************************************************************************
  * Summary:
- *  Updates the send buffer and submits data to the controller
+ *  Drains queued button transitions, in BT stack thread context. Each one
+ *  is sent as a burst of ISOC_MAX_BURST_COUNT SDUs; a transition stays
+ *  queued until the controller has bufs for its whole burst.
  ******************************************************************************/
 CY_SECTION_RAMFUNC_BEGIN
 static void isoc_send_data_handler()
 {
-    wiced_bool_t result;
     uint32_t data_length;
-    uint8_t* p_buf = NULL;
+    uint16_t num_pkts;
+    uint8_t* p_bufs[ISOC_MAX_BURST_COUNT];
+    uint32_t lens[ISOC_MAX_BURST_COUNT];
+    uint8_t count;
+    uint8_t sent;
     uint8_t* p = NULL;
-    wiced_bool_t pressed = pressed_saved;
-
-    // Submit data to the controller only if it has bufs available
-    if(number_of_iso_data_packet_bufs)
-    {
-        if((p_buf = iso_dhm_get_data_buffer()) != NULL)
-        {
-               p = p_buf;
-
-            UINT16_TO_STREAM(p, isoc.cis_established_data.cis.cis_conn_handle);
-            UINT16_TO_STREAM(p, sequence);
-            UINT8_TO_STREAM(p, pressed);
+    uint8_t pressed;
+    uint16_t cis_handle = isoc.cis_established_data.cis.cis_conn_handle;
 
 #if 0  // Normally you would only send the required payload but here we want to 
        // exercise the max_sdu_size to stress the system more
-            data_length = p_data - p_buf;
+    data_length = sizeof(iso_rx_data_central_button_state_type_t);
 #else
-            data_length = isoc.max_payload;
+    data_length = isoc.max_payload;
 #endif
 
-            /* Set P_TX gpio link high to indicate calling lower layer to 
-               send data */
-            set_gpio_high(P_TX);
+    // An SDU larger than the controller's ISO data packet is segmented, so
+    // reserve bufs for every fragment before the first one goes out
+    num_pkts = iso_dhm_get_num_packets(ISOC_TX_TS_FLAG, data_length);
 
-            // pass data to data handler module
-            result = iso_dhm_send_packet(sequence,
-                     isoc.cis_established_data.cis.cis_conn_handle, WICED_FALSE,
-                     p_buf, data_length);
+    // Submit data to the controller only if it has bufs available, otherwise
+    // isoc_credits_available_cback drains the queue once they come back
+    while((isoc_tx_queue.tail != isoc_tx_queue.head)
+          && iso_dhm_has_credits(cis_handle, ISOC_MAX_BURST_COUNT * num_pkts))
+    {
+        // read the entry only after seeing the head that published it
+        __DMB();
+        pressed = isoc_tx_queue.desc[isoc_tx_queue.tail
+                                     & (ISOC_TX_QUEUE_SIZE - 1)].button_state;
 
-            if(result)
+        count = 0;
+        while(count < ISOC_MAX_BURST_COUNT)
+        {
+            if((p_bufs[count] = iso_dhm_get_data_buffer_for_handle(cis_handle))
+               == NULL)
             {
-                number_of_iso_data_packet_bufs--;
-                isoc_tx_count++;
+                break;
             }
-            APP_ISOC_TRACE("[%s] handle:0x%x SN:%d data_length:%d sdu_count:%d"
-                           " result:%d", __FUNCTION__,
-                           isoc.cis_established_data.cis.cis_conn_handle,
-                           sequence, (int)data_length, (int)isoc_tx_count, result);
+            p = p_bufs[count];
+
+            UINT16_TO_STREAM(p, cis_handle);
+            UINT16_TO_STREAM(p, (uint16_t)(sequence + count));
+            UINT8_TO_STREAM(p, pressed);
+
+            lens[count++] = data_length;
+        }
 
-            // Set P_TX gpio link low to indicate return from lower layer
-            set_gpio_low(P_TX);
+        // out of SDU buffers, the transition stays queued
+        if(!count)
+        {
+            break;
         }
-     }
 
-    sequence++;
+        // release the entry to the producer
+        __DMB();
+        isoc_tx_queue.tail++;
+
+        /* Set P_TX gpio link high to indicate calling lower layer to 
+           send data */
+        set_gpio_high(P_TX);
+
+        // pass the burst to data handler module
+        sent = iso_dhm_send_burst(cis_handle, sequence, ISOC_TX_TS_FLAG, p_bufs,
+                                  lens, count);
+
+        isoc_tx_count += sent;
+
+        APP_ISOC_TRACE("[%s] handle:0x%x SN:%d data_length:%d sdu_count:%d"
+                       " sent:%d/%d", __FUNCTION__, cis_handle, sequence,
+                       (int)data_length, (int)isoc_tx_count, sent, count);
+
+        // Set P_TX gpio link low to indicate return from lower layer
+        set_gpio_low(P_TX);
+
+        sequence += count;
+    }
 }
 CY_SECTION_RAMFUNC_END
 
+#ifdef ISOC_BIG_SOURCE
+/******************************************************************************
+ * Function Name: isoc_big_send_data_handler
+ ******************************************************************************
+ * Summary:
+ *  Drains queued button transitions into the BIG, one SDU on every BIS per
+ *  transition. Without acks there is nothing to wait for, a transition
+ *  that finds no controller credits is simply not sent on that BIS.
+ ******************************************************************************/
+static void isoc_big_send_data_handler(void)
+{
+    uint8_t sdu[ISO_SDU_SIZE] = {0};
+    uint8_t* p;
+    uint8_t sent;
+
+    while(isoc_tx_queue.tail != isoc_tx_queue.head)
+    {
+        __DMB();
+        p = sdu;
+        UINT16_TO_STREAM(p, 0);
+        UINT16_TO_STREAM(p, sequence);
+        UINT8_TO_STREAM(p, isoc_tx_queue.desc[isoc_tx_queue.tail
+                                              & (ISOC_TX_QUEUE_SIZE - 1)].button_state);
+        __DMB();
+        isoc_tx_queue.tail++;
+
+        sent = isoc_big_source_send(sdu, isoc.max_payload);
+        isoc_tx_count += sent;
+
+        APP_ISOC_TRACE("[%s] SN:%d sent on %d BIS", __FUNCTION__, sequence, sent);
+        sequence++;
+    }
+}
+#endif
+
+#ifdef ISO_DHM_SHM_DATA_PATH
+/******************************************************************************
+ * Function Name: isoc_shm_data_path
+ ******************************************************************************
+ * Summary:
+ *  Points the data path at the data handler's shared memory ring for its
+ *  direction, unless this CIS already fell back to HCI
+ ******************************************************************************/
+static void isoc_shm_data_path(wiced_ble_isoc_setup_data_path_info_t *p_info)
+{
+    // p_info keeps pointing at it
+    static uint8_t csc[2][ISO_DHM_SHM_CSC_LEN];
+    uint8_t input = (p_info->data_path_dir == WICED_BLE_ISOC_DPD_INPUT);
+
+    if (isoc.shm_fallback)
+    {
+        return;
+    }
+
+    p_info->data_path_id = ISO_DHM_SHM_DATA_PATH_ID;
+    p_info->codec_id[0] = ISO_DHM_SHM_CODING_FORMAT;
+    p_info->codec_id[1] = (uint8_t)(ISO_DHM_SHM_COMPANY_ID & 0xFF);
+    p_info->codec_id[2] = (uint8_t)(ISO_DHM_SHM_COMPANY_ID >> 8);
+    p_info->codec_id[3] = (uint8_t)(ISO_DHM_SHM_VENDOR_CODEC_ID & 0xFF);
+    p_info->codec_id[4] = (uint8_t)(ISO_DHM_SHM_VENDOR_CODEC_ID >> 8);
+    p_info->csc_length = iso_dhm_shm_get_csc(input, csc[input]);
+    p_info->p_csc = csc[input];
+}
+
+/******************************************************************************
+ * Function Name: isoc_shm_poll
+ ******************************************************************************
+ * Summary:
+ *  Hands completed and received ring SDUs to the data handler
+ ******************************************************************************/
+static void isoc_shm_poll(WICED_TIMER_PARAM_TYPE param)
+{
+    iso_dhm_shm_poll();
+}
+#endif
+
+#ifdef ISO_DHM_CAPTURE
+/******************************************************************************
+ * Function Name: isoc_capture_write
+ ******************************************************************************
+ * Summary:
+ *  Prints a piece of the btsnoop capture as "ISOCAP <hex>" trace lines. The
+ *  file is recovered from the log with
+ *  grep -o 'ISOCAP [0-9a-f]*' log | cut -d' ' -f2 | xxd -r -p > iso.btsnoop
+ ******************************************************************************/
+static void isoc_capture_write(const uint8_t *p_data, uint32_t len)
+{
+    static const char hex[] = "0123456789abcdef";
+    char line[ISOC_CAPTURE_LINE_BYTES * 2 + 1];
+    uint32_t n, i;
+
+    while (len)
+    {
+        n = (len < ISOC_CAPTURE_LINE_BYTES) ? len : ISOC_CAPTURE_LINE_BYTES;
+        for (i = 0; i < n; i++)
+        {
+            line[2 * i] = hex[p_data[i] >> 4];
+            line[2 * i + 1] = hex[p_data[i] & 0x0F];
+        }
+        line[2 * n] = '\0';
+        WICED_BT_TRACE("ISOCAP %s", line);
+        p_data += n;
+        len -= n;
+    }
+}
+#endif
+
 /*******************************************************************************
  * Function Name: isoc_stop
  *******************************************************************************
@@ -311,6 +581,18 @@ static void isoc_stop(void)
 
     isoc_rx_count = 0;
     isoc_tx_count = 0;
+    isoc_rx_lost_count = 0;
+
+    // consumer side flush, transitions queued for the old CIS are not sent
+    isoc_tx_queue.tail = isoc_tx_queue.head;
+
+#ifdef ISO_DHM_SHM_DATA_PATH
+    wiced_stop_timer(&isoc.isoc_shm_poll_timer);
+#endif
+
+#ifdef ISOC_MONITOR_LINK_QUALITY
+    wiced_stop_timer(&isoc.isoc_link_quality_timer);
+#endif
 
 #ifdef ISOC_STATS
     wiced_stop_timer(&iso_stats_timer);
@@ -326,8 +608,49 @@ static void isoc_stop(void)
  ******************************************************************************/
 static void isoc_stats_timeout( WICED_TIMER_PARAM_TYPE param )
 {
-    APP_ISOC_TRACE("[ISOC STATS] isoc_rx_count:%d  isoc_tx_count:%d",
-                   (int)isoc_rx_count, (int)isoc_tx_count);
+    uint16_t cis_handle = isoc.cis_established_data.cis.cis_conn_handle;
+    iso_dhm_handle_stats_t stats = {0};
+    iso_dhm_latency_hist_t hist = {0};
+    uint32_t timed = 0;
+    int i;
+
+    iso_dhm_get_handle_stats(cis_handle, &stats);
+    iso_dhm_get_latency_histogram(cis_handle, &hist);
+
+    APP_ISOC_TRACE("[ISOC STATS] isoc_rx_count:%d  isoc_tx_count:%d  isoc_rx_lost_count:%d"
+                   "  tx_queue_dropped:%d",
+                   (int)isoc_rx_count, (int)isoc_tx_count, (int)isoc_rx_lost_count,
+                   (int)isoc_tx_queue.dropped);
+    APP_ISOC_TRACE("[ISOC STATS] credit_starvations:%d  credit_starved_ms:%d",
+                   (int)stats.credit_starvations,
+                   (int)(stats.credit_starved_us / 1000));
+    APP_ISOC_TRACE("[ISOC STATS] tx_sdus:%d  tx_write_failures:%d  tx_completed:%d"
+                   "  rx_packets:%d  rx_zero_len:%d  oversize:%d",
+                   (int)stats.tx_sdus, (int)stats.tx_write_failures,
+                   (int)stats.tx_completed, (int)stats.rx_packets,
+                   (int)stats.rx_zero_len, (int)stats.oversize);
+    APP_ISOC_TRACE("[ISOC STATS] rx_valid:%d  rx_possibly_invalid:%d  rx_lost:%d"
+                   "  rx_missing:%d  rx_malformed:%d",
+                   (int)stats.rx_valid, (int)stats.rx_possibly_invalid,
+                   (int)stats.rx_lost, (int)stats.rx_missing,
+                   (int)stats.rx_malformed);
+
+    // send-to-complete latency, only the non-empty log2 buckets
+    for (i = 0; i < ISO_DHM_LATENCY_BUCKETS; i++)
+    {
+        if (hist.bucket[i])
+        {
+            APP_ISOC_TRACE("[ISOC STATS] latency >= %d us: %d", 1 << i,
+                           (int)hist.bucket[i]);
+            timed += hist.bucket[i];
+        }
+    }
+    APP_ISOC_TRACE("[ISOC STATS] latency mean_us:%d  max_us:%d  untimed:%d",
+                   timed ? (int)(hist.total_us / timed) : 0,
+                   (int)hist.max_us, (int)hist.untimed);
+#ifdef ISOC_MONITOR_LINK_QUALITY
+    isoc_link_quality_report();
+#endif
 }
 #endif
 
@@ -341,6 +664,27 @@ static void isoc_management_cback(wiced_ble_isoc_event_t event,
                                   wiced_ble_isoc_event_data_t *p_event_data)
 {
     APP_ISOC_TRACE("[%s] %d", __FUNCTION__, event);
+#ifdef ISOC_BIG_SOURCE
+    // BIG created / terminated and BIS data path events
+    if (isoc_big_source_event(event, p_event_data))
+    {
+        return;
+    }
+#endif
+#ifdef ISOC_BIG_SINK
+    // BIG sync established / lost and BIS data path events
+    if (isoc_big_sink_event(event, p_event_data))
+    {
+        return;
+    }
+#endif
+#ifdef ISOC_TEST_MODE
+    // the data paths taken down for the ISO test mode
+    if (isoc_test_mode_event(event, p_event_data))
+    {
+        return;
+    }
+#endif
     wiced_result_t result = WICED_SUCCESS;
     wiced_ble_isoc_setup_data_path_info_t data_path_info =
     {   .isoc_conn_hdl = isoc.cis_established_data.cis.cis_conn_handle,
@@ -387,17 +731,26 @@ static void isoc_management_cback(wiced_ble_isoc_event_t event,
                            isoc.cis_established_data.cis.cis_id,
                            isoc.cis_established_data.cis.cis_conn_handle);
 
-            data_path_info.isoc_conn_hdl = isoc.cis_established_data.cis.cis_conn_handle;
-            dp_dir = WICED_BLE_ISOC_DPD_INPUT;
-            data_path_info.data_path_dir = WICED_BLE_ISOC_DPD_INPUT;
+            // completed packets are accepted for this CIS from now on
+            iso_dhm_set_handle_valid(isoc.cis_established_data.cis.cis_conn_handle,
+                                     WICED_TRUE);
 
+            if (!iso_dhm_add_handle(isoc.cis_established_data.cis.cis_conn_handle,
+                                    ISOC_RESERVED_SDU_BUFS))
+            {
+                APP_ISOC_TRACE("[%s] no SDU buffers reserved", __FUNCTION__);
+            }
 
-#if defined(CYW55572) || WICED_BTSTACK_VERSION_MINOR > 8
-            result = (wiced_result_t) wiced_ble_isoc_setup_data_path(&data_path_info);
-#else
-            result = (wiced_result_t) wiced_ble_isoc_setup_data_path(&data_path_info);
-#endif
-            APP_ISOC_TRACE("[%s] setup_data_path %d", __FUNCTION__, result);
+            if (!iso_dhm_enable_jitter_buffer(isoc.cis_established_data.cis.cis_conn_handle,
+                                              ISOC_RX_JITTER_BUFFER_DEPTH, rx_lost_handler))
+            {
+                APP_ISOC_TRACE("[%s] RX jitter buffer not enabled", __FUNCTION__);
+            }
+
+            // SDUs of this CIS go to rx_handler, which counts them in isoc_rx_count
+            isoc_bind_rx_handler(isoc.cis_established_data.cis.cis_conn_handle);
+
+            isoc_setup_data_paths();
         }
         else
         {
@@ -413,6 +766,14 @@ static void isoc_management_cback(wiced_ble_isoc_event_t event,
     case WICED_BLE_ISOC_CIS_DISCONNECTED_EVT:
         APP_ISOC_TRACE("WICED_BLE_ISOC_CIS_DISCONNECTED");
         isoc_stop();
+#ifdef ISO_DHM_CAPTURE
+        // the last packets of the CIS, for tools/iso_dhm_bench/iso_dhm_replay
+        iso_dhm_capture_dump(isoc_capture_write);
+        iso_dhm_capture_clear();
+#endif
+        iso_dhm_set_handle_valid(p_event_data->cis_disconnect.cis.cis_conn_handle,
+                                 WICED_FALSE);
+        iso_dhm_remove_handle(p_event_data->cis_disconnect.cis.cis_conn_handle);
         APP_ISOC_TRACE("[%s] CIS Disconnected cig: %d  cis: %d %d %d reason:%d",
                        __FUNCTION__,
                        p_event_data->cis_disconnect.cis.cig_id,
@@ -438,6 +799,19 @@ static void isoc_management_cback(wiced_ble_isoc_event_t event,
         {
             APP_ISOC_TRACE("[%s] Datapath setup failure, status: %d",
                 __FUNCTION__, p_event_data->datapath.status);
+#ifdef ISO_DHM_SHM_DATA_PATH
+            // no shared memory data path in this controller, retry the
+            // direction over HCI and keep HCI for the rest of the CIS
+            if(!isoc.shm_fallback && (isoc.cis_established_data.cis.cis_conn_handle
+                                      == p_event_data->datapath.conn_hdl))
+            {
+                isoc.shm_fallback = WICED_TRUE;
+                data_path_info.data_path_dir = *p_dir;
+                result = (wiced_result_t) wiced_ble_isoc_setup_data_path(&data_path_info);
+                APP_ISOC_TRACE("[%s] HCI data path fallback %d", __FUNCTION__,
+                               result);
+            }
+#endif
             return;
         }
         
@@ -452,10 +826,26 @@ static void isoc_management_cback(wiced_ble_isoc_event_t event,
             return;
         }
 
+#ifdef ISO_DHM_SHM_DATA_PATH
+        // the path just set up is the shared memory one unless it fell back
+        if(!isoc.shm_fallback)
+        {
+            if(*p_dir == WICED_BLE_ISOC_DPD_INPUT)
+            {
+                iso_dhm_shm_enable(p_event_data->datapath.conn_hdl, WICED_TRUE);
+            }
+            wiced_start_timer(&isoc.isoc_shm_poll_timer,
+                              ISOC_SHM_POLL_INTERVAL_IN_MSECONDS);
+        }
+#endif
+
         if ( *p_dir== WICED_BLE_ISOC_DPD_INPUT)
         {
             dp_dir = WICED_BLE_ISOC_DPD_OUTPUT;
             data_path_info.data_path_dir = WICED_BLE_ISOC_DPD_OUTPUT;
+#ifdef ISO_DHM_SHM_DATA_PATH
+            isoc_shm_data_path(&data_path_info);
+#endif
 #if defined(CYW55572) || WICED_BTSTACK_VERSION_MINOR > 8
     result = (wiced_result_t) wiced_ble_isoc_setup_data_path(&data_path_info);
 #else
@@ -493,28 +883,93 @@ static void isoc_management_cback(wiced_ble_isoc_event_t event,
     CY_UNUSED_PARAMETER(result);
 }
 
+/******************************************************************************
+ * Function Name: isoc_setup_data_paths
+ ******************************************************************************
+ * Summary:
+ *  Sets up the input data path of the CIS, the output data path follows
+ *  once it is set up
+ *****************************************************************************/
+void isoc_setup_data_paths(void)
+{
+    wiced_result_t result;
+    wiced_ble_isoc_setup_data_path_info_t data_path_info =
+    {   .isoc_conn_hdl = isoc.cis_established_data.cis.cis_conn_handle,
+        .data_path_dir = WICED_BLE_ISOC_DPD_INPUT,
+        .data_path_id = WICED_BLE_ISOC_DPID_HCI,
+        .controller_delay = 0,
+        .codec_id = {0,0,0,0,0},
+        .csc_length = 0,
+        .p_csc = NULL,
+        .p_app_ctx = &dp_dir,
+    };
+
+    dp_dir = WICED_BLE_ISOC_DPD_INPUT;
+#ifdef ISO_DHM_SHM_DATA_PATH
+    isoc.shm_fallback = WICED_FALSE;
+    isoc_shm_data_path(&data_path_info);
+#endif
+
+#if defined(CYW55572) || WICED_BTSTACK_VERSION_MINOR > 8
+    result = (wiced_result_t) wiced_ble_isoc_setup_data_path(&data_path_info);
+#else
+    result = (wiced_result_t) wiced_ble_isoc_setup_data_path(&data_path_info);
+#endif
+    APP_ISOC_TRACE("[%s] setup_data_path %d", __FUNCTION__, result);
+
+    CY_UNUSED_PARAMETER(result);
+}
+
+/******************************************************************************
+ * Function Name: isoc_bind_rx_handler
+ ******************************************************************************
+ * Summary:
+ *  Delivers the SDUs received on conn_hdl, e.g. a BIS, to rx_handler
+ *****************************************************************************/
+void isoc_bind_rx_handler(uint16_t conn_hdl)
+{
+    if (!iso_dhm_register_handle_rx_cb(conn_hdl, rx_handler, &isoc_rx_count))
+    {
+        APP_ISOC_TRACE("[%s] 0x%x not bound", __FUNCTION__, conn_hdl);
+    }
+}
+
+/******************************************************************************
+ * Function Name: isoc_cis_handle
+ ******************************************************************************
+ * Summary:
+ *  Returns the connection handle of the established CIS, 0 if there is none
+ *****************************************************************************/
+uint16_t isoc_cis_handle(void)
+{
+    return isoc.cis_established_data.cis.cis_conn_handle;
+}
+
 /******************************************************************************
  * Function Name: rx_handler
  ******************************************************************************
  * Summary:
- *  Handles received ISOC data
+ *  Handles received ISOC data of the CIS it is bound to, p_ctx points to
+ *  the counter of received SDUs
  *****************************************************************************/
 CY_SECTION_RAMFUNC_BEGIN
-static void rx_handler(uint16_t cis_handle, uint8_t *p_data, uint32_t length)
+static void rx_handler(void *p_ctx, const iso_dhm_rx_meta_t *p_meta, uint8_t *p_data)
 {
     iso_rx_data_central_button_state_type_t* p_rx_data = (
         iso_rx_data_central_button_state_type_t*) p_data;
+    uint32_t *p_rx_count = (uint32_t *) p_ctx;
 
-    //APP_ISOC_TRACE("[%s] length:%d", __FUNCTION__, length);
+    //APP_ISOC_TRACE("[%s] length:%d", __FUNCTION__, p_meta->sdu_len);
 
-    if (length >= sizeof(iso_rx_data_central_button_state_type_t))
+    // empty SDUs, e.g. lost ones, are shorter than any payload
+    if (p_meta->sdu_len >= sizeof(iso_rx_data_central_button_state_type_t))
     {
         set_gpio_high(P_DBG1);
 
         APP_ISOC_TRACE("[rx_data] cis_conn_handle:0x%x SN:%d button_state:%d",
             p_rx_data->cis_conn_handle, p_rx_data->sequence_num,
             p_rx_data->button_state);
-        isoc_rx_count++;
+        (*p_rx_count)++;
 
         set_gpio_low(P_DBG1);
 
@@ -523,6 +978,17 @@ static void rx_handler(uint16_t cis_handle, uint8_t *p_data, uint32_t length)
 }
 CY_SECTION_RAMFUNC_END
 
+/******************************************************************************
+ * Function Name: rx_lost_handler
+ ******************************************************************************
+ * Summary:
+ *  Counts SDUs the ISO data handler found missing from the PSN sequence
+ *****************************************************************************/
+static void rx_lost_handler(uint16_t cis_handle, uint16_t psn)
+{
+    isoc_rx_lost_count++;
+}
+
 /******************************************************************************
  * Function Name: isoc_get_psn_start
  ******************************************************************************
@@ -532,6 +998,12 @@ CY_SECTION_RAMFUNC_END
 CY_SECTION_RAMFUNC_BEGIN
 static void isoc_get_psn_start(WICED_TIMER_PARAM_TYPE param)
 {
+#ifdef ISOC_TEST_MODE
+    if (isoc_test_mode_active())
+    {
+        return;
+    }
+#endif
     if(isoc.cis_established_data.cis.cis_conn_handle)
     {
         APP_ISOC_TRACE("[%s] sending HCI_BLE_ISOC_READ_TX_SYNC for handle %02x",
@@ -557,14 +1029,19 @@ CY_SECTION_RAMFUNC_BEGIN
 static void isoc_send_data_num_complete_packets_evt(uint16_t cis_handle,
                                                     uint16_t num_sent)
 {
-    /*APP_ISOC_TRACE("[%s] 0x%02x %d %d %d", __FUNCTION__, cis_handle, 
-     num_sent, number_of_iso_data_packet_bufs,
-     number_of_iso_data_packet_bufs+num_sent); */
-    number_of_iso_data_packet_bufs += num_sent;
+    /*APP_ISOC_TRACE("[%s] 0x%02x %d %d", __FUNCTION__, cis_handle, 
+     num_sent, iso_dhm_get_credits()); */
+
+    // queued transitions wait for isoc_credits_available_cback instead
+    if(isoc_tx_queue.tail != isoc_tx_queue.head)
+    {
+        return;
+    }
+
     wiced_start_timer(&isoc.isoc_keep_alive_timer,
                       ISOC_KEEP_ALIVE_TIMEOUT_IN_SECONDS);
 
-    if(number_of_iso_data_packet_bufs == CONTROLLER_ISO_DATA_PACKET_BUFS)
+    if(iso_dhm_get_credits() == CONTROLLER_ISO_DATA_PACKET_BUFS)
     {
         // Start keep alive timer
         wiced_start_timer(&isoc.isoc_keep_alive_timer,
@@ -575,6 +1052,19 @@ static void isoc_send_data_num_complete_packets_evt(uint16_t cis_handle,
 }
 CY_SECTION_RAMFUNC_END
 
+/******************************************************************************
+ * Function Name: isoc_credits_available_cback
+ ******************************************************************************
+ * Summary:
+ *  The ISO data handler has the controller bufs the queued transitions were
+ *  waiting for
+ *****************************************************************************/
+static void isoc_credits_available_cback(uint16_t cis_handle,
+                                         uint16_t num_credits)
+{
+    isoc_send_data_handler();
+}
+
 #ifdef ISOC_MONITOR_FOR_DROPPED_SDUs
 /******************************************************************************
  * Function Name: isoc_vse_cback
@@ -616,6 +1106,125 @@ static void isoc_vse_cback(uint8_t len, uint8_t *p)
 }
 #endif // ISOC_MONITOR_FOR_DROPPED_SDUs
 
+#ifdef ISOC_MONITOR_LINK_QUALITY
+/******************************************************************************
+ * Function Name: isoc_link_quality_cback
+ ******************************************************************************
+ * Summary:
+ *  Stores the LE Read ISO Link Quality counters in the time series ring and
+ *  traces the ones that went up since the previous sample
+ *****************************************************************************/
+static void isoc_link_quality_cback(
+                wiced_bt_dev_vendor_specific_command_complete_params_t *p_params)
+{
+    isoc_link_quality_evt_t *evt = (isoc_link_quality_evt_t *)p_params->p_param_buf;
+    isoc_link_quality_sample_t *p_sample;
+    isoc_link_quality_sample_t *p_prev;
+
+    if ((p_params->param_len < sizeof(isoc_link_quality_evt_t)) || evt->status)
+    {
+        APP_ISOC_TRACE("[%s] status:%d", __FUNCTION__,
+                       p_params->param_len ? evt->status : 0xFF);
+        return;
+    }
+    // the CIS went away while the command was pending
+    if (evt->connHandle != isoc.cis_established_data.cis.cis_conn_handle)
+    {
+        return;
+    }
+
+    p_sample = &isoc_link_quality.sample[isoc_link_quality.count
+                                         & (ISOC_LINK_QUALITY_HISTORY - 1)];
+    p_sample->ts_ms = (uint32_t)(clock_SystemTimeMicroseconds64() / 1000);
+    p_sample->tx_unacked_packets = evt->tx_unacked_packets;
+    p_sample->tx_flushed_packets = evt->tx_flushed_packets;
+    p_sample->tx_last_subevent_packets = evt->tx_last_subevent_packets;
+    p_sample->retransmitted_packets = evt->retransmitted_packets;
+    p_sample->crc_error_packets = evt->crc_error_packets;
+    p_sample->rx_unreceived_packets = evt->rx_unreceived_packets;
+    p_sample->duplicate_packets = evt->duplicate_packets;
+
+    if (isoc_link_quality.count++ == 0)
+    {
+        return;
+    }
+
+    // the counters that point at lost SDUs
+    p_prev = &isoc_link_quality.sample[(isoc_link_quality.count - 2)
+                                       & (ISOC_LINK_QUALITY_HISTORY - 1)];
+    if ((p_sample->tx_flushed_packets != p_prev->tx_flushed_packets)
+        || (p_sample->crc_error_packets != p_prev->crc_error_packets)
+        || (p_sample->rx_unreceived_packets != p_prev->rx_unreceived_packets))
+    {
+        APP_ISOC_TRACE("[ISOC LINK QUALITY %02x] flushed:+%d  crc_errors:+%d"
+                       "  rx_unreceived:+%d  last_subevent:+%d",
+                       evt->connHandle,
+                       (int)(p_sample->tx_flushed_packets - p_prev->tx_flushed_packets),
+                       (int)(p_sample->crc_error_packets - p_prev->crc_error_packets),
+                       (int)(p_sample->rx_unreceived_packets - p_prev->rx_unreceived_packets),
+                       (int)(p_sample->tx_last_subevent_packets
+                             - p_prev->tx_last_subevent_packets));
+    }
+}
+
+/******************************************************************************
+ * Function Name: isoc_link_quality_timeout
+ ******************************************************************************
+ * Summary:
+ *  Sends LE Read ISO Link Quality for the established CIS
+ *****************************************************************************/
+static void isoc_link_quality_timeout(WICED_TIMER_PARAM_TYPE param)
+{
+    uint16_t hdl = isoc.cis_established_data.cis.cis_conn_handle;
+
+    if (hdl)
+    {
+        wiced_bt_dev_vendor_specific_command(HCI_LE_READ_ISO_LINK_QUALITY_OPCODE, 2,
+                                             (uint8_t *)&hdl, isoc_link_quality_cback);
+    }
+}
+
+#ifdef ISOC_STATS
+/******************************************************************************
+ * Function Name: isoc_link_quality_report
+ ******************************************************************************
+ * Summary:
+ *  Prints how much each counter went up over the samples in the ring
+ *****************************************************************************/
+static void isoc_link_quality_report(void)
+{
+    isoc_link_quality_sample_t *p_new;
+    isoc_link_quality_sample_t *p_old;
+    uint32_t span;
+
+    if (isoc_link_quality.count < 2)
+    {
+        return;
+    }
+
+    span = (isoc_link_quality.count < ISOC_LINK_QUALITY_HISTORY) ?
+           isoc_link_quality.count : ISOC_LINK_QUALITY_HISTORY;
+    p_new = &isoc_link_quality.sample[(isoc_link_quality.count - 1)
+                                      & (ISOC_LINK_QUALITY_HISTORY - 1)];
+    p_old = &isoc_link_quality.sample[(isoc_link_quality.count - span)
+                                      & (ISOC_LINK_QUALITY_HISTORY - 1)];
+
+    APP_ISOC_TRACE("[ISOC STATS] link quality over %d ms: tx_unacked:%d  flushed:%d"
+                   "  last_subevent:%d  retransmitted:%d",
+                   (int)(p_new->ts_ms - p_old->ts_ms),
+                   (int)(p_new->tx_unacked_packets - p_old->tx_unacked_packets),
+                   (int)(p_new->tx_flushed_packets - p_old->tx_flushed_packets),
+                   (int)(p_new->tx_last_subevent_packets - p_old->tx_last_subevent_packets),
+                   (int)(p_new->retransmitted_packets - p_old->retransmitted_packets));
+    APP_ISOC_TRACE("[ISOC STATS] link quality crc_errors:%d  rx_unreceived:%d"
+                   "  duplicates:%d",
+                   (int)(p_new->crc_error_packets - p_old->crc_error_packets),
+                   (int)(p_new->rx_unreceived_packets - p_old->rx_unreceived_packets),
+                   (int)(p_new->duplicate_packets - p_old->duplicate_packets));
+}
+#endif
+#endif // ISOC_MONITOR_LINK_QUALITY
+
 /*******************************************************************************
  * public functions
  ******************************************************************************/
@@ -633,7 +1242,7 @@ wiced_bool_t isoc_cis_connected(void)
 CY_SECTION_RAMFUNC_END
 
 /******************************************************************************
- * Function Name: isoc_send_data
+ * Function Name: isoc_start
  ******************************************************************************
  * Summary:
  *  Called once the ISOC data patch has been established.
@@ -647,22 +1256,45 @@ void isoc_start(void)
 
     sequence = 0;
 
+#ifdef ISOC_MONITOR_LINK_QUALITY
+    // counters restart with the CIS, so does the time series
+    isoc_link_quality.count = 0;
+    wiced_start_timer(&isoc.isoc_link_quality_timer,
+                      ISOC_LINK_QUALITY_INTERVAL_IN_MSECONDS);
+#endif
+
 #ifdef ISOC_STATS
     wiced_start_timer(&iso_stats_timer, ISOC_STATS_TIMEOUT);
 #endif
 }
 
 /******************************************************************************
- * Function Name: isoc_send_data
+ * Function Name: isoc_tx_kick
  ******************************************************************************
  * Summary:
- *  prepare to send one packet.
+ *  Runs in the BT stack thread once transitions are queued. Reads the PSN to
+ *  start from; read_psn_cb then drains the queue.
  *****************************************************************************/
-CY_SECTION_RAMFUNC_BEGIN
-void isoc_send_data(wiced_bool_t c)
+static wiced_result_t isoc_tx_kick(void *param)
 {
-    // save button state
-    pressed_saved = c;
+    // transitions queued from here on serialize another kick
+    isoc_tx_kick_pending = 0;
+    __DMB();
+
+#ifdef ISOC_TEST_MODE
+    // the controller generates the test SDUs, nothing can be sent
+    if (isoc_test_mode_active())
+    {
+        return WICED_SUCCESS;
+    }
+#endif
+#ifdef ISOC_BIG_SOURCE
+    if (isoc_big_source_ready())
+    {
+        isoc_big_send_data_handler();
+        return WICED_SUCCESS;
+    }
+#endif
 
     // stop keep alive timer if it is running
     if (wiced_is_timer_in_use(&isoc.isoc_keep_alive_timer))
@@ -671,7 +1303,43 @@ void isoc_send_data(wiced_bool_t c)
     }
 
     isoc_get_psn_start(0);
+    return WICED_SUCCESS;
+}
 
+/******************************************************************************
+ * Function Name: isoc_send_data
+ ******************************************************************************
+ * Summary:
+ *  Queues a button transition to be sent by the BT stack thread. The ring is
+ *  lock-free, the transition is dropped if it is full. Wiced timers belong to
+ *  the stack thread, so the kick is handed over with
+ *  wiced_app_event_serialize, and only when none is pending yet.
+ *****************************************************************************/
+CY_SECTION_RAMFUNC_BEGIN
+void isoc_send_data(wiced_bool_t c)
+{
+    uint32_t head = isoc_tx_queue.head;
+
+    if (head - isoc_tx_queue.tail >= ISOC_TX_QUEUE_SIZE)
+    {
+        isoc_tx_queue.dropped++;
+        return;
+    }
+
+    isoc_tx_queue.desc[head & (ISOC_TX_QUEUE_SIZE - 1)].button_state = c;
+    __DMB();
+    isoc_tx_queue.head = head + 1;
+
+    if (!isoc_tx_kick_pending)
+    {
+        isoc_tx_kick_pending = 1;
+        __DMB();
+        if (wiced_app_event_serialize(isoc_tx_kick, NULL) != WICED_SUCCESS)
+        {
+            // the next transition tries again
+            isoc_tx_kick_pending = 0;
+        }
+    }
 }
 CY_SECTION_RAMFUNC_END
 
@@ -688,7 +1356,13 @@ void isoc_init(void)
     wiced_bt_ble_phy_preferences_t phy_preferences = {0};
 
     wiced_ble_isoc_cfg_t isoc_config = {
+#if defined(ISOC_BIG_SOURCE)
+        .max_bis = ISOC_BIG_NUM_BIS,
+#elif defined(ISOC_BIG_SINK)
+        .max_bis = ISOC_BIG_SINK_NUM_BIS,
+#else
         .max_bis =0,
+#endif
         .max_cis =1,
     };
     APP_ISOC_TRACE("[%s]", __FUNCTION__);
@@ -699,9 +1373,14 @@ void isoc_init(void)
 
     isoc.max_payload = p_wiced_bt_cfg_settings->p_isoc_cfg->max_sdu_size;
 
-    // Init ISOC data handler module and register ISOC receive data handler
+    // Init ISOC data handler module, rx_handler is bound to each CIS once
+    // it is established
     iso_dhm_init(p_wiced_bt_cfg_settings->p_isoc_cfg,
-                 isoc_send_data_num_complete_packets_evt, rx_handler);
+                 isoc_send_data_num_complete_packets_evt, NULL);
+    iso_dhm_register_credits_cb(isoc_credits_available_cback);
+#ifdef ISO_DHM_CAPTURE
+    iso_dhm_capture_enable(WICED_TRUE);
+#endif
 
     // Register ISOC management callback
 
@@ -715,6 +1394,18 @@ void isoc_init(void)
     wiced_init_timer(&isoc.isoc_keep_alive_timer, isoc_get_psn_start, 0,
                      WICED_SECONDS_PERIODIC_TIMER);
 
+#ifdef ISO_DHM_SHM_DATA_PATH
+    // Init timer that polls the shared memory data path rings
+    wiced_init_timer(&isoc.isoc_shm_poll_timer, isoc_shm_poll, 0,
+                     WICED_MILLI_SECONDS_PERIODIC_TIMER);
+#endif
+
+#ifdef ISOC_MONITOR_LINK_QUALITY
+    // Init timer that samples the link quality counters
+    wiced_init_timer(&isoc.isoc_link_quality_timer, isoc_link_quality_timeout, 0,
+                     WICED_MILLI_SECONDS_PERIODIC_TIMER);
+#endif
+
 #ifdef ISOC_STATS
     // Init stats timer
     wiced_init_timer(&iso_stats_timer, isoc_stats_timeout, 0, 
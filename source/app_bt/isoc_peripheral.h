@@ -14,7 +14,10 @@
 void isoc_init();
 void isoc_send_data(wiced_bool_t c);
 wiced_bool_t isoc_cis_connected();
+uint16_t isoc_cis_handle(void);
 void isoc_start();
+void isoc_setup_data_paths(void);
+void isoc_bind_rx_handler(uint16_t conn_hdl);
 
 #endif // ISOC_PERIPHERAL_H_
 
@@ -0,0 +1,396 @@
+/*
+ * $ Copyright YEAR Cypress Semiconductor $
+ */
+/*
+ * isoc_test_mode.c
+ *
+ * LE ISO test mode on the CIS: the data paths are removed and the controller
+ * sends and checks test SDUs itself (LE ISO Transmit / Receive Test), so the
+ * link can be measured without the application or HCI ISO data in the way.
+ */
+#ifdef ISOC_TEST_MODE
+
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "cyhal.h"
+#include "cy_retarget_io.h"
+#include "wiced_bt_trace.h"
+#include "wiced_bt_types.h"
+#include "wiced_bt_dev.h"
+#include "wiced_timer.h"
+#include "wiced_bt_stack_platform.h"
+#include "iso_data_handler.h"
+#include "isoc_test_mode.h"
+#include "app.h"
+#include  "app_terminal_trace.h"
+
+/******************************************************************************
+ *  defines
+ ******************************************************************************/
+#if ISOC_TRACE
+# define APP_TEST_TRACE                        WICED_BT_TRACE
+#else
+# define APP_TEST_TRACE(...)
+#endif
+
+#define HCI_LE_ISO_TRANSMIT_TEST_OPCODE     0x2070
+#define HCI_LE_ISO_RECEIVE_TEST_OPCODE      0x2071
+#define HCI_LE_ISO_READ_TEST_COUNTERS_OPCODE 0x2072
+#define HCI_LE_ISO_TEST_END_OPCODE          0x2073
+
+// status(1) handle(2) received(4) missed(4) failed(4)
+#define ISOC_TEST_COUNTERS_LEN              15
+
+// counters are printed this often while the test runs
+#define ISOC_TEST_COUNTERS_INTERVAL_IN_SECONDS  5
+
+#ifndef ENABLE_BT_SPY_LOG
+#define ISOC_TEST_CONSOLE_TASK_PRIORITY     1
+#define ISOC_TEST_CONSOLE_TASK_STACK_SIZE   (256u)
+#define ISOC_TEST_CONSOLE_POLL_IN_MSECONDS  50
+#endif
+
+typedef enum
+{
+    ISOC_TEST_IDLE,
+    ISOC_TEST_STARTING,                     // waiting for the data paths to be removed
+    ISOC_TEST_TX_TEST,                      // waiting for LE ISO Transmit Test to complete
+    ISOC_TEST_RUNNING,
+    ISOC_TEST_ENDING,                       // waiting for LE ISO Test End to complete
+} isoc_test_state_t;
+
+/******************************************************************************
+ *  local variables
+ ******************************************************************************/
+static struct
+{
+    isoc_test_state_t state;
+    uint16_t conn_hdl;
+    wiced_timer_t counters_timer;
+} test = {0};
+
+/*******************************************************************************
+ * private functions
+ ******************************************************************************/
+/*
+ * The stack has no API for the LE ISO test commands, so they go out as raw
+ * HCI commands through wiced_bt_dev_vendor_specific_command, which takes any
+ * opcode. The callbacks parse the Command Complete return parameters as the
+ * Core spec lays them out, starting with the status byte.
+ */
+static wiced_result_t isoc_test_mode_command(uint16_t opcode, uint8_t param_len,
+                uint8_t payload_type,
+                wiced_bt_dev_vendor_specific_command_complete_cback_t *p_cback)
+{
+    uint8_t param[3];
+
+    param[0] = (uint8_t)test.conn_hdl;
+    param[1] = (uint8_t)(test.conn_hdl >> 8);
+    param[2] = payload_type;
+
+    return wiced_bt_dev_vendor_specific_command(opcode, param_len, param, p_cback);
+}
+
+static uint32_t isoc_test_mode_le32(const uint8_t *p)
+{
+    return p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/******************************************************************************
+ * Function Name: isoc_test_mode_print_counters
+ ******************************************************************************
+ * Summary:
+ *  Prints the counters returned by LE ISO Read Test Counters / Test End
+ *****************************************************************************/
+static void isoc_test_mode_print_counters(const char *p_tag,
+                wiced_bt_dev_vendor_specific_command_complete_params_t *p_params)
+{
+    const uint8_t *p = p_params->p_param_buf;
+
+    if ((p_params->param_len < ISOC_TEST_COUNTERS_LEN) || p[0])
+    {
+        WICED_BT_TRACE("ISO test %s failed, status:%d", p_tag,
+                       p_params->param_len ? p[0] : 0xFF);
+        return;
+    }
+
+    WICED_BT_TRACE("ISO test %s handle:0x%x received:%u missed:%u failed:%u", p_tag,
+                   p[1] | (p[2] << 8),
+                   (unsigned)isoc_test_mode_le32(&p[3]),
+                   (unsigned)isoc_test_mode_le32(&p[7]),
+                   (unsigned)isoc_test_mode_le32(&p[11]));
+}
+
+static void isoc_test_mode_counters_cback(
+                wiced_bt_dev_vendor_specific_command_complete_params_t *p_params)
+{
+    isoc_test_mode_print_counters("counters", p_params);
+}
+
+/******************************************************************************
+ * Function Name: isoc_test_mode_end_cback
+ ******************************************************************************
+ * Summary:
+ *  Prints the final counters and hands the CIS back to the application
+ *****************************************************************************/
+static void isoc_test_mode_end_cback(
+                wiced_bt_dev_vendor_specific_command_complete_params_t *p_params)
+{
+    isoc_test_mode_print_counters("end", p_params);
+
+    test.state = ISOC_TEST_IDLE;
+    if (isoc_cis_handle() == test.conn_hdl)
+    {
+        isoc_setup_data_paths();
+    }
+}
+
+static void isoc_test_mode_rx_test_cback(
+                wiced_bt_dev_vendor_specific_command_complete_params_t *p_params)
+{
+    uint8_t status = p_params->param_len ? p_params->p_param_buf[0] : 0xFF;
+
+    APP_TEST_TRACE("[%s] status:%d", __FUNCTION__, status);
+
+    // the CIS may carry test SDUs one way only, keep counting the other
+    if (status)
+    {
+        WICED_BT_TRACE("ISO receive test not started, status:%d", status);
+    }
+    test.state = ISOC_TEST_RUNNING;
+    wiced_start_timer(&test.counters_timer, ISOC_TEST_COUNTERS_INTERVAL_IN_SECONDS);
+}
+
+static void isoc_test_mode_tx_test_cback(
+                wiced_bt_dev_vendor_specific_command_complete_params_t *p_params)
+{
+    uint8_t status = p_params->param_len ? p_params->p_param_buf[0] : 0xFF;
+
+    APP_TEST_TRACE("[%s] status:%d", __FUNCTION__, status);
+
+    if (status)
+    {
+        WICED_BT_TRACE("ISO transmit test not started, status:%d", status);
+    }
+    isoc_test_mode_command(HCI_LE_ISO_RECEIVE_TEST_OPCODE, 3, ISOC_TEST_PAYLOAD_TYPE,
+                           isoc_test_mode_rx_test_cback);
+}
+
+static void isoc_test_mode_counters_timeout(WICED_TIMER_PARAM_TYPE param)
+{
+    if (test.state == ISOC_TEST_RUNNING)
+    {
+        isoc_test_mode_read_counters();
+    }
+}
+
+#ifndef ENABLE_BT_SPY_LOG
+/******************************************************************************
+ * Function Name: isoc_test_mode_kick
+ ******************************************************************************
+ * Summary:
+ *  Runs a console command in the BT stack thread, the key comes in param
+ *****************************************************************************/
+static wiced_result_t isoc_test_mode_kick(void *param)
+{
+    switch ((char)(uintptr_t)param)
+    {
+    case 's':
+        if (isoc_test_mode_start(isoc_cis_handle()) != WICED_SUCCESS)
+        {
+            WICED_BT_TRACE("ISO test not started, no CIS or already running");
+        }
+        break;
+    case 'c':
+        isoc_test_mode_read_counters();
+        break;
+    case 'e':
+        isoc_test_mode_end();
+        break;
+    default:
+        break;
+    }
+    return WICED_SUCCESS;
+}
+
+/******************************************************************************
+ * Function Name: isoc_test_mode_console_task
+ ******************************************************************************
+ * Summary:
+ *  Reads test mode keys from the debug UART and passes them to the BT stack
+ *  thread
+ *****************************************************************************/
+static void isoc_test_mode_console_task(void *arg)
+{
+    uint8_t c;
+
+    for (;;)
+    {
+        if (!cyhal_uart_readable(&cy_retarget_io_uart_obj)
+            || (cyhal_uart_getc(&cy_retarget_io_uart_obj, &c, 1) != CY_RSLT_SUCCESS))
+        {
+            vTaskDelay(pdMS_TO_TICKS(ISOC_TEST_CONSOLE_POLL_IN_MSECONDS));
+            continue;
+        }
+        if ((c == 's') || (c == 'c') || (c == 'e'))
+        {
+            // each key is its own event, none is lost to the next one
+            wiced_app_event_serialize(isoc_test_mode_kick, (void *)(uintptr_t)c);
+        }
+    }
+}
+#endif
+
+/*******************************************************************************
+ * public functions
+ ******************************************************************************/
+/******************************************************************************
+ * Function Name: isoc_test_mode_init
+ ******************************************************************************
+ * Summary:
+ *  Initializes the test mode timer and the console task
+ *****************************************************************************/
+void isoc_test_mode_init(void)
+{
+    wiced_init_timer(&test.counters_timer, isoc_test_mode_counters_timeout, 0,
+                     WICED_SECONDS_PERIODIC_TIMER);
+
+#ifndef ENABLE_BT_SPY_LOG
+    xTaskCreate(isoc_test_mode_console_task,
+                "ISO Test Console",
+                ISOC_TEST_CONSOLE_TASK_STACK_SIZE,
+                NULL,
+                ISOC_TEST_CONSOLE_TASK_PRIORITY,
+                NULL);
+    WICED_BT_TRACE("ISO test mode: 's' start, 'c' counters, 'e' end");
+#endif
+}
+
+/******************************************************************************
+ * Function Name: isoc_test_mode_start
+ ******************************************************************************
+ * Summary:
+ *  Removes both data paths of the CIS, the test starts once they are gone
+ *****************************************************************************/
+wiced_result_t isoc_test_mode_start(uint16_t cis_conn_hdl)
+{
+    wiced_result_t result;
+
+    if (!cis_conn_hdl || (test.state != ISOC_TEST_IDLE))
+    {
+        return WICED_BADARG;
+    }
+
+    test.conn_hdl = cis_conn_hdl;
+    test.state = ISOC_TEST_STARTING;
+
+#ifdef ISO_DHM_SHM_DATA_PATH
+    iso_dhm_shm_enable(cis_conn_hdl, WICED_FALSE);
+#endif
+    result = (wiced_result_t) wiced_ble_isoc_remove_data_path(cis_conn_hdl,
+                        WICED_BLE_ISOC_DPD_INPUT_BIT | WICED_BLE_ISOC_DPD_OUTPUT_BIT, NULL);
+    APP_TEST_TRACE("[%s] handle:0x%x remove DP %d", __FUNCTION__, cis_conn_hdl, result);
+
+    if (result != WICED_SUCCESS)
+    {
+        test.state = ISOC_TEST_IDLE;
+    }
+    return result;
+}
+
+/******************************************************************************
+ * Function Name: isoc_test_mode_read_counters
+ ******************************************************************************
+ * Summary:
+ *  Sends LE ISO Read Test Counters, the counters are printed on completion
+ *****************************************************************************/
+wiced_result_t isoc_test_mode_read_counters(void)
+{
+    if (test.state != ISOC_TEST_RUNNING)
+    {
+        return WICED_ERROR;
+    }
+    return isoc_test_mode_command(HCI_LE_ISO_READ_TEST_COUNTERS_OPCODE, 2, 0,
+                                  isoc_test_mode_counters_cback);
+}
+
+/******************************************************************************
+ * Function Name: isoc_test_mode_end
+ ******************************************************************************
+ * Summary:
+ *  Sends LE ISO Test End
+ *****************************************************************************/
+wiced_result_t isoc_test_mode_end(void)
+{
+    if (test.state != ISOC_TEST_RUNNING)
+    {
+        return WICED_ERROR;
+    }
+
+    wiced_stop_timer(&test.counters_timer);
+    test.state = ISOC_TEST_ENDING;
+    return isoc_test_mode_command(HCI_LE_ISO_TEST_END_OPCODE, 2, 0,
+                                  isoc_test_mode_end_cback);
+}
+
+/******************************************************************************
+ * Function Name: isoc_test_mode_active
+ ******************************************************************************
+ * Summary:
+ *  Returns TRUE while the CIS is (being put) in test mode
+ *****************************************************************************/
+wiced_bool_t isoc_test_mode_active(void)
+{
+    return test.state != ISOC_TEST_IDLE;
+}
+
+/******************************************************************************
+ * Function Name: isoc_test_mode_event
+ ******************************************************************************
+ * Summary:
+ *  Starts the test once the data paths are removed and drops the test state
+ *  when the CIS goes away
+ *****************************************************************************/
+wiced_bool_t isoc_test_mode_event(wiced_ble_isoc_event_t event,
+                                  wiced_ble_isoc_event_data_t *p_event_data)
+{
+    switch (event)
+    {
+    case WICED_BLE_ISOC_DATA_PATH_REMOVED_EVT:
+        if ((test.state != ISOC_TEST_STARTING)
+            || (p_event_data->datapath.conn_hdl != test.conn_hdl))
+        {
+            return WICED_FALSE;
+        }
+        if (WICED_BT_SUCCESS != p_event_data->datapath.status)
+        {
+            WICED_BT_TRACE("ISO test not started, remove DP status:%d",
+                           p_event_data->datapath.status);
+            test.state = ISOC_TEST_IDLE;
+            return WICED_TRUE;
+        }
+        test.state = ISOC_TEST_TX_TEST;
+        isoc_test_mode_command(HCI_LE_ISO_TRANSMIT_TEST_OPCODE, 3, ISOC_TEST_PAYLOAD_TYPE,
+                               isoc_test_mode_tx_test_cback);
+        return WICED_TRUE;
+
+    case WICED_BLE_ISOC_CIS_DISCONNECTED_EVT:
+        // the application still cleans up the CIS
+        if (p_event_data->cis_disconnect.cis.cis_conn_handle == test.conn_hdl)
+        {
+            wiced_stop_timer(&test.counters_timer);
+            test.state = ISOC_TEST_IDLE;
+            test.conn_hdl = 0;
+        }
+        return WICED_FALSE;
+
+    default:
+        return WICED_FALSE;
+    }
+}
+
+#endif // ISOC_TEST_MODE
+
+/* [] END OF FILE */
@@ -0,0 +1,50 @@
+/*
+ * $ Copyright YEAR Cypress Semiconductor $
+ */
+/*
+ * @file isoc_test_mode.h
+ *
+ * @brief API for the LE ISO test mode of the CIS. Built only with
+ *        ISOC_TEST_MODE defined (make ISO_TEST_MODE=1).
+ */
+#ifndef ISOC_TEST_MODE_H_
+#define ISOC_TEST_MODE_H_
+
+#include "wiced_bt_isoc.h"
+
+#ifdef ISOC_TEST_MODE
+
+// LE ISO Transmit Test payload type: 0 zero length, 1 variable length,
+// 2 maximum length
+#ifndef ISOC_TEST_PAYLOAD_TYPE
+#define ISOC_TEST_PAYLOAD_TYPE              2
+#endif
+
+/* Sets up the test mode timers and, with the console on retarget-io, the
+ * console task: 's' starts the test, 'c' prints the counters, 'e' ends it */
+void isoc_test_mode_init(void);
+
+/*
+ * Takes down the data paths of the CIS and starts the controller generating
+ * and checking test SDUs on it (LE ISO Transmit / Receive Test)
+ */
+wiced_result_t isoc_test_mode_start(uint16_t cis_conn_hdl);
+
+/* Reads and prints the received, missed and failed counters */
+wiced_result_t isoc_test_mode_read_counters(void);
+
+/* Ends the test, prints the final counters and sets the data paths up again */
+wiced_result_t isoc_test_mode_end(void);
+
+/* WICED_TRUE from isoc_test_mode_start until the test has ended */
+wiced_bool_t isoc_test_mode_active(void);
+
+/* ISOC management events for the test mode; returns WICED_TRUE if consumed */
+wiced_bool_t isoc_test_mode_event(wiced_ble_isoc_event_t event,
+                                  wiced_ble_isoc_event_data_t *p_event_data);
+
+#endif // ISOC_TEST_MODE
+
+#endif // ISOC_TEST_MODE_H_
+
+/* [] END OF FILE */
@@ -0,0 +1,1124 @@
+/*
+ * $ Copyright YEAR Cypress Semiconductor $
+ */
+/*
+ * bench.c
+ *
+ * Host microbenchmark for the ISO data handler hot path. Runs
+ * iso_dhm_send_packet, iso_dhm_process_rx_data and
+ * iso_dhm_process_num_completed_pkts against the simulated controller and
+ * reports ns/SDU and btstack pool allocations/SDU.
+ *
+ * Usage: iso_dhm_bench [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "wiced_bt_cfg.h"
+#include "iso_data_handler.h"
+#include "sim_controller.h"
+
+/******************************************************************************
+ *  defines
+ ******************************************************************************/
+#define BENCH_DEFAULT_ITERATIONS    200000
+#define BENCH_CIS_CONN_HANDLE       0x0040
+#define BENCH_BIS_CONN_HANDLE       0x0041
+#define BENCH_MAX_SDU_SIZE          500
+#define BENCH_RESERVED_SDU_BUFS     2
+#define BENCH_MAX_BURST             8
+#define BENCH_SDU_INTERVAL          10000
+#define BENCH_RX_PKT_SIZE           (BENCH_MAX_SDU_SIZE + 12)
+#define BENCH_RX_FRAG_LEN           64
+#define BENCH_RX_MAX_FRAGS          ((BENCH_MAX_SDU_SIZE / BENCH_RX_FRAG_LEN) + 1)
+#define BENCH_JB_DEPTH              2
+#define BENCH_JB_PATTERN_LEN        8
+#define BENCH_MUX_CHANNELS          4
+#define BENCH_SG_APP_HDR_SIZE       5
+#define BENCH_OVERSIZE_SDU_LEN      1500
+
+/******************************************************************************
+ *  local variables
+ ******************************************************************************/
+typedef struct
+{
+    const char  *name;
+    uint16_t    sdu_size;
+    uint8_t     ts_flag;
+    uint32_t    iterations;
+    uint64_t    elapsed_ns;
+    uint32_t    allocations;
+    uint32_t    failures;
+} bench_result_t;
+
+static const uint16_t bench_sdu_sizes[] = { 0, 8, 100, 251, BENCH_MAX_SDU_SIZE };
+
+// arrival order of each group of PSNs for the jitter buffer case: 1 and 2 swapped, 6 lost
+static const int8_t bench_jb_pattern[BENCH_JB_PATTERN_LEN] = { 0, 2, 1, 3, 4, 5, -1, 7 };
+
+// ISO data packet lengths reported by the simulated controller
+static const uint16_t bench_iso_data_packet_lens[] = { SIM_CONTROLLER_ISO_DATA_PACKET_LEN, 64 };
+
+static const wiced_bt_cfg_isoc_t bench_isoc_cfg = {
+    .max_sdu_size = BENCH_MAX_SDU_SIZE,
+    .channel_count = 1,
+    .max_cis_conn = 1,
+    .max_cig_count = 1,
+    .max_buffers_per_cis = 4,
+    .max_big_count = 0
+};
+
+static volatile uint32_t bench_rx_bytes;
+static volatile uint32_t bench_num_completed;
+static volatile uint32_t bench_lost;
+static volatile uint32_t bench_concealed;
+static volatile uint32_t bench_credits_cb_count;
+static volatile uint32_t bench_channel_bytes[BENCH_MUX_CHANNELS];
+
+/******************************************************************************
+ * private functions
+ ******************************************************************************/
+static uint64_t bench_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void bench_rx_cb(uint16_t cis_handle, uint8_t *p_data, uint32_t length)
+{
+    (void)cis_handle;
+    (void)p_data;
+    bench_rx_bytes += length;
+}
+
+static void bench_rx_v2_cb(const iso_dhm_rx_meta_t *p_meta, uint8_t *p_data)
+{
+    (void)p_data;
+    bench_rx_bytes += p_meta->sdu_len;
+}
+
+// p_ctx is the byte counter of the consumer bound to the handle
+static void bench_handle_rx_cb(void *p_ctx, const iso_dhm_rx_meta_t *p_meta, uint8_t *p_data)
+{
+    (void)p_data;
+    *(uint32_t *)p_ctx += p_meta->sdu_len;
+}
+
+static void bench_num_complete_cb(uint16_t cis_handle, uint16_t num_sent)
+{
+    (void)cis_handle;
+    bench_num_completed += num_sent;
+}
+
+static void bench_lost_cb(uint16_t cis_handle, uint16_t psn)
+{
+    (void)cis_handle;
+    (void)psn;
+    bench_lost++;
+}
+
+static void bench_conceal_cb(uint16_t cis_handle, uint16_t psn)
+{
+    (void)cis_handle;
+    (void)psn;
+    bench_concealed++;
+}
+
+static void bench_credits_cb(uint16_t cis_handle, uint16_t num_credits)
+{
+    (void)cis_handle;
+    (void)num_credits;
+    bench_credits_cb_count++;
+}
+
+static void bench_channel_cb(const iso_dhm_rx_meta_t *p_meta, uint8_t channel,
+                             uint8_t *p_data, uint16_t len)
+{
+    (void)p_meta;
+    (void)p_data;
+    bench_channel_bytes[channel] += len;
+}
+
+static uint32_t bench_allocations(void)
+{
+    const sim_controller_stats_t *p_stats = sim_controller_stats();
+
+    return p_stats->buffers_allocated + p_stats->pools_created;
+}
+
+/*
+ * Sends are timed in batches of one credit window, i.e. as many SDUs as fit
+ * in the controller's ISO data packets once segmented. Returning the credits
+ * through the simulated Number Of Completed Packets event happens outside
+ * the timed region so only the TX path is measured.
+ */
+static void bench_send(bench_result_t *p_res)
+{
+    uint16_t psn = 0;
+    uint32_t done = 0;
+    uint32_t sdus_per_window = iso_dhm_get_buffer_info()->total_num_iso_data_packets
+                               / iso_dhm_get_num_packets(p_res->ts_flag,
+                                                         p_res->sdu_size);
+
+    sim_controller_reset(BENCH_CIS_CONN_HANDLE);
+
+    if (!sdus_per_window)
+    {
+        p_res->iterations = 0;
+        return;
+    }
+
+    while (done < p_res->iterations)
+    {
+        uint32_t batch = p_res->iterations - done;
+        uint64_t start;
+        uint32_t i;
+
+        if (batch > sdus_per_window)
+            batch = sdus_per_window;
+
+        start = bench_now_ns();
+        for (i = 0; i < batch; i++)
+        {
+            uint8_t *p_buf = iso_dhm_get_data_buffer_for_handle(BENCH_CIS_CONN_HANDLE);
+
+            if (!p_buf || !iso_dhm_send_packet(psn++, BENCH_CIS_CONN_HANDLE,
+                                               p_res->ts_flag, p_buf,
+                                               p_res->sdu_size))
+            {
+                p_res->failures++;
+            }
+        }
+        p_res->elapsed_ns += bench_now_ns() - start;
+
+        sim_controller_complete();
+        done += batch;
+    }
+
+    p_res->allocations = bench_allocations();
+}
+
+/*
+ * Same credit windows as bench_send, with every SDU gathered by
+ * iso_dhm_send_packet_sg from a 5 byte application header and the payload
+ * in two pieces. The copy is inside the timed region.
+ */
+static void bench_send_sg(bench_result_t *p_res)
+{
+    static const uint8_t app_hdr[BENCH_SG_APP_HDR_SIZE];
+    static const uint8_t payload[BENCH_MAX_SDU_SIZE];
+    iso_dhm_iovec_t iov[3];
+    uint16_t psn = 0;
+    uint32_t done = 0;
+    uint32_t payload_len;
+    uint32_t sdus_per_window = iso_dhm_get_buffer_info()->total_num_iso_data_packets
+                               / iso_dhm_get_num_packets(p_res->ts_flag,
+                                                         p_res->sdu_size);
+
+    sim_controller_reset(BENCH_CIS_CONN_HANDLE);
+
+    if (!sdus_per_window || p_res->sdu_size < BENCH_SG_APP_HDR_SIZE)
+    {
+        p_res->iterations = 0;
+        return;
+    }
+
+    payload_len = p_res->sdu_size - BENCH_SG_APP_HDR_SIZE;
+    iov[0].p_base = app_hdr;
+    iov[0].len = BENCH_SG_APP_HDR_SIZE;
+    iov[1].p_base = payload;
+    iov[1].len = payload_len / 2;
+    iov[2].p_base = payload + payload_len / 2;
+    iov[2].len = payload_len - payload_len / 2;
+
+    while (done < p_res->iterations)
+    {
+        uint32_t batch = p_res->iterations - done;
+        uint64_t start;
+        uint32_t i;
+
+        if (batch > sdus_per_window)
+            batch = sdus_per_window;
+
+        start = bench_now_ns();
+        for (i = 0; i < batch; i++)
+        {
+            if (!iso_dhm_send_packet_sg(psn++, BENCH_CIS_CONN_HANDLE,
+                                        p_res->ts_flag, iov, 3))
+            {
+                p_res->failures++;
+            }
+        }
+        p_res->elapsed_ns += bench_now_ns() - start;
+
+        sim_controller_complete();
+        done += batch;
+    }
+
+    p_res->allocations = bench_allocations();
+}
+
+/*
+ * Same credit windows as bench_send, but each window is submitted with one
+ * iso_dhm_send_burst call. Buffer allocation is inside the timed region.
+ */
+static void bench_send_burst(bench_result_t *p_res)
+{
+    uint8_t *p_bufs[BENCH_MAX_BURST];
+    uint32_t lens[BENCH_MAX_BURST];
+    uint16_t psn = 0;
+    uint32_t done = 0;
+    uint32_t sdus_per_window = iso_dhm_get_buffer_info()->total_num_iso_data_packets
+                               / iso_dhm_get_num_packets(p_res->ts_flag,
+                                                         p_res->sdu_size);
+
+    sim_controller_reset(BENCH_CIS_CONN_HANDLE);
+
+    // every SDU of a burst holds a pool buffer until the burst is sent
+    if (sdus_per_window > iso_dhm_get_buffer_info()->pool_buf_count)
+        sdus_per_window = iso_dhm_get_buffer_info()->pool_buf_count;
+    if (sdus_per_window > BENCH_MAX_BURST)
+        sdus_per_window = BENCH_MAX_BURST;
+    if (!sdus_per_window)
+    {
+        p_res->iterations = 0;
+        return;
+    }
+
+    while (done < p_res->iterations)
+    {
+        uint32_t batch = p_res->iterations - done;
+        uint32_t n = 0;
+        uint64_t start;
+
+        if (batch > sdus_per_window)
+            batch = sdus_per_window;
+
+        start = bench_now_ns();
+        while (n < batch
+               && (p_bufs[n] = iso_dhm_get_data_buffer_for_handle(BENCH_CIS_CONN_HANDLE)) != NULL)
+        {
+            lens[n++] = p_res->sdu_size;
+        }
+        p_res->failures += batch - iso_dhm_send_burst(BENCH_CIS_CONN_HANDLE, psn,
+                                                      p_res->ts_flag, p_bufs, lens, (uint8_t)n);
+        p_res->elapsed_ns += bench_now_ns() - start;
+
+        psn += batch;
+        sim_controller_complete();
+        done += batch;
+    }
+
+    p_res->allocations = bench_allocations();
+}
+
+static void bench_rx(bench_result_t *p_res)
+{
+    static uint8_t pkt[BENCH_RX_PKT_SIZE];
+    uint32_t pkt_len;
+    uint64_t start;
+    uint32_t i;
+
+    sim_controller_reset(BENCH_CIS_CONN_HANDLE);
+    bench_rx_bytes = 0;
+
+    pkt_len = sim_controller_build_rx_packet(pkt, BENCH_CIS_CONN_HANDLE,
+                                             p_res->ts_flag, 0,
+                                             p_res->sdu_size);
+
+    start = bench_now_ns();
+    for (i = 0; i < p_res->iterations; i++)
+    {
+        sim_controller_inject_rx(pkt, pkt_len);
+    }
+    p_res->elapsed_ns = bench_now_ns() - start;
+
+    if (bench_rx_bytes != (uint32_t)(p_res->sdu_size * p_res->iterations))
+        p_res->failures++;
+
+    p_res->allocations = bench_allocations();
+}
+
+/*
+ * SDUs larger than BENCH_RX_FRAG_LEN arrive as first/continuation/last
+ * fragments and go through reassembly; smaller ones are skipped.
+ */
+static void bench_rx_fragmented(bench_result_t *p_res)
+{
+    static uint8_t pkts[BENCH_RX_MAX_FRAGS * (BENCH_RX_FRAG_LEN + 12)];
+    uint32_t lens[BENCH_RX_MAX_FRAGS];
+    uint32_t num_pkts;
+    uint64_t start;
+    uint32_t i, j;
+
+    sim_controller_reset(BENCH_CIS_CONN_HANDLE);
+    bench_rx_bytes = 0;
+
+    num_pkts = sim_controller_build_rx_fragments(pkts, lens, BENCH_RX_MAX_FRAGS,
+                                                 BENCH_CIS_CONN_HANDLE,
+                                                 p_res->ts_flag, 0,
+                                                 p_res->sdu_size,
+                                                 BENCH_RX_FRAG_LEN);
+    if (!num_pkts)
+    {
+        p_res->iterations = 0;
+        return;
+    }
+
+    start = bench_now_ns();
+    for (i = 0; i < p_res->iterations; i++)
+    {
+        uint8_t *p = pkts;
+
+        for (j = 0; j < num_pkts; j++)
+        {
+            sim_controller_inject_rx(p, lens[j]);
+            p += lens[j];
+        }
+    }
+    p_res->elapsed_ns = bench_now_ns() - start;
+
+    if (bench_rx_bytes != (uint32_t)(p_res->sdu_size * p_res->iterations))
+        p_res->failures++;
+
+    p_res->allocations = bench_allocations();
+}
+
+/*
+ * Complete SDUs arrive slightly out of order with one PSN in every
+ * BENCH_JB_PATTERN_LEN missing; the jitter buffer must hand every received
+ * SDU over and report exactly the missing PSNs. The concealment hook, which
+ * runs on arrival, also sees the swapped PSN as skipped when its successor
+ * overtakes it.
+ */
+static void bench_rx_jitter(bench_result_t *p_res)
+{
+    static uint8_t pkt[BENCH_RX_PKT_SIZE];
+    uint32_t groups = p_res->iterations / BENCH_JB_PATTERN_LEN;
+    iso_dhm_handle_stats_t before, after;
+    uint32_t pkt_len, psn_offset;
+    uint64_t start;
+    uint32_t i, j;
+
+    sim_controller_reset(BENCH_CIS_CONN_HANDLE);
+    bench_rx_bytes = 0;
+    bench_lost = 0;
+    bench_concealed = 0;
+    iso_dhm_register_conceal_cb(bench_conceal_cb);
+    iso_dhm_get_handle_stats(BENCH_CIS_CONN_HANDLE, &before);
+
+    if (!groups || !iso_dhm_enable_jitter_buffer(BENCH_CIS_CONN_HANDLE, BENCH_JB_DEPTH, bench_lost_cb))
+    {
+        p_res->failures++;
+        return;
+    }
+    p_res->iterations = groups * BENCH_JB_PATTERN_LEN;
+
+    pkt_len = sim_controller_build_rx_packet(pkt, BENCH_CIS_CONN_HANDLE,
+                                             p_res->ts_flag, 0,
+                                             p_res->sdu_size);
+    // packet header, optional time stamp, then the PSN
+    psn_offset = 4 + (p_res->ts_flag ? 4 : 0);
+
+    start = bench_now_ns();
+    for (i = 0; i < groups; i++)
+    {
+        for (j = 0; j < BENCH_JB_PATTERN_LEN; j++)
+        {
+            uint16_t psn;
+
+            if (bench_jb_pattern[j] < 0)
+                continue;
+
+            psn = (uint16_t)(i * BENCH_JB_PATTERN_LEN + bench_jb_pattern[j]);
+            pkt[psn_offset] = (uint8_t)psn;
+            pkt[psn_offset + 1] = (uint8_t)(psn >> 8);
+            sim_controller_inject_rx(pkt, pkt_len);
+        }
+    }
+    p_res->elapsed_ns = bench_now_ns() - start;
+
+    iso_dhm_disable_jitter_buffer(BENCH_CIS_CONN_HANDLE);
+
+    if (bench_rx_bytes != (uint32_t)(p_res->sdu_size * (p_res->iterations - groups)))
+        p_res->failures++;
+    if (bench_lost != groups)
+        p_res->failures++;
+
+    iso_dhm_register_conceal_cb(NULL);
+    iso_dhm_get_handle_stats(BENCH_CIS_CONN_HANDLE, &after);
+    if (bench_concealed != 2 * groups || after.rx_missing - before.rx_missing != 2 * groups
+        || after.rx_valid - before.rx_valid != p_res->iterations - groups)
+        p_res->failures++;
+
+    p_res->allocations = bench_allocations();
+}
+
+/*
+ * Each SDU carries one frame per channel, packed with iso_dhm_mux_pack; every
+ * channel callback must see exactly its own frames.
+ */
+static void bench_rx_mux(bench_result_t *p_res)
+{
+    static uint8_t pkt[BENCH_RX_PKT_SIZE];
+    static uint8_t frame_data[BENCH_MAX_SDU_SIZE];
+    iso_dhm_mux_frame_t frames[BENCH_MUX_CHANNELS];
+    iso_dhm_handle_stats_t stats;
+    uint32_t pkt_len, payload, frame_len;
+    uint64_t start;
+    uint32_t i;
+    uint8_t c;
+
+    if (p_res->sdu_size < 1 + 2 * BENCH_MUX_CHANNELS + BENCH_MUX_CHANNELS)
+    {
+        p_res->iterations = 0;
+        return;
+    }
+
+    sim_controller_reset(BENCH_CIS_CONN_HANDLE);
+    memset((void *)bench_channel_bytes, 0, sizeof(bench_channel_bytes));
+
+    // split what the channel table leaves over evenly, the last channel takes the rest
+    payload = p_res->sdu_size - (1 + 2 * BENCH_MUX_CHANNELS);
+    frame_len = payload / BENCH_MUX_CHANNELS;
+    for (c = 0; c < BENCH_MUX_CHANNELS; c++)
+    {
+        iso_dhm_register_channel_cb(c, bench_channel_cb);
+        frames[c].channel = c;
+        frames[c].p_data = frame_data;
+        frames[c].len = (uint16_t)((c == BENCH_MUX_CHANNELS - 1) ?
+                                   payload - frame_len * (BENCH_MUX_CHANNELS - 1) : frame_len);
+    }
+
+    pkt_len = sim_controller_build_rx_packet(pkt, BENCH_CIS_CONN_HANDLE,
+                                             p_res->ts_flag, 0,
+                                             p_res->sdu_size);
+    // packet header, optional time stamp, PSN and SDU length, then the SDU
+    if (iso_dhm_mux_pack(&pkt[4 + (p_res->ts_flag ? 4 : 0) + 4], frames, BENCH_MUX_CHANNELS)
+        != p_res->sdu_size || !iso_dhm_enable_mux(BENCH_CIS_CONN_HANDLE, WICED_TRUE))
+    {
+        p_res->failures++;
+        return;
+    }
+
+    start = bench_now_ns();
+    for (i = 0; i < p_res->iterations; i++)
+    {
+        sim_controller_inject_rx(pkt, pkt_len);
+    }
+    p_res->elapsed_ns = bench_now_ns() - start;
+
+    iso_dhm_enable_mux(BENCH_CIS_CONN_HANDLE, WICED_FALSE);
+
+    for (c = 0; c < BENCH_MUX_CHANNELS; c++)
+    {
+        if (bench_channel_bytes[c] != frames[c].len * p_res->iterations)
+            p_res->failures++;
+        iso_dhm_register_channel_cb(c, NULL);
+    }
+    if (!iso_dhm_get_handle_stats(BENCH_CIS_CONN_HANDLE, &stats) || stats.mux_errors)
+        p_res->failures++;
+
+    p_res->allocations = bench_allocations();
+}
+
+/*
+ * SDUs go to the callback bound to the handle, with its context, and no
+ * longer to the global ones. A second handle in the same demux slot must
+ * be refused while the first holds it.
+ */
+static void bench_rx_demux(bench_result_t *p_res)
+{
+    static uint8_t pkt[BENCH_RX_PKT_SIZE];
+    uint32_t consumer_bytes = 0;
+    uint32_t pkt_len;
+    uint64_t start;
+    uint32_t i;
+
+    sim_controller_reset(BENCH_CIS_CONN_HANDLE);
+    bench_rx_bytes = 0;
+
+    if (!iso_dhm_register_handle_rx_cb(BENCH_CIS_CONN_HANDLE, bench_handle_rx_cb, &consumer_bytes)
+        || iso_dhm_register_handle_rx_cb(BENCH_CIS_CONN_HANDLE + 8, bench_handle_rx_cb, NULL))
+    {
+        p_res->failures++;
+        return;
+    }
+
+    pkt_len = sim_controller_build_rx_packet(pkt, BENCH_CIS_CONN_HANDLE,
+                                             p_res->ts_flag, 0,
+                                             p_res->sdu_size);
+
+    start = bench_now_ns();
+    for (i = 0; i < p_res->iterations; i++)
+    {
+        sim_controller_inject_rx(pkt, pkt_len);
+    }
+    p_res->elapsed_ns = bench_now_ns() - start;
+
+    iso_dhm_register_handle_rx_cb(BENCH_CIS_CONN_HANDLE, NULL, NULL);
+
+    if (consumer_bytes != (uint32_t)(p_res->sdu_size * p_res->iterations) || bench_rx_bytes)
+        p_res->failures++;
+
+    p_res->allocations = bench_allocations();
+}
+
+/*
+ * SDUs go through the shared memory TX ring instead of HCI ISO data packets,
+ * in batches of one ring. The simulated controller drains the ring and
+ * iso_dhm_shm_poll reports the completions outside the timed region.
+ */
+static void bench_send_shm(bench_result_t *p_res)
+{
+    uint8_t csc[ISO_DHM_SHM_CSC_LEN];
+    uint32_t completed = bench_num_completed;
+    uint16_t psn = 0;
+    uint32_t done = 0;
+
+    sim_controller_reset(BENCH_CIS_CONN_HANDLE);
+
+    if (!sim_controller_shm_attach(WICED_TRUE, csc, iso_dhm_shm_get_csc(WICED_TRUE, csc))
+        || !iso_dhm_shm_enable(BENCH_CIS_CONN_HANDLE, WICED_TRUE))
+    {
+        p_res->failures++;
+        return;
+    }
+
+    while (done < p_res->iterations)
+    {
+        uint32_t batch = p_res->iterations - done;
+        uint64_t start;
+        uint32_t i;
+
+        if (batch > ISO_DHM_SHM_RING_SLOTS)
+            batch = ISO_DHM_SHM_RING_SLOTS;
+
+        start = bench_now_ns();
+        for (i = 0; i < batch; i++)
+        {
+            uint8_t *p_buf = iso_dhm_get_data_buffer_for_handle(BENCH_CIS_CONN_HANDLE);
+
+            if (!p_buf || !iso_dhm_send_packet(psn++, BENCH_CIS_CONN_HANDLE,
+                                               p_res->ts_flag, p_buf,
+                                               p_res->sdu_size))
+            {
+                p_res->failures++;
+            }
+        }
+        p_res->elapsed_ns += bench_now_ns() - start;
+
+        sim_controller_shm_complete();
+        iso_dhm_shm_poll();
+        done += batch;
+    }
+
+    iso_dhm_shm_enable(BENCH_CIS_CONN_HANDLE, WICED_FALSE);
+
+    if (sim_controller_stats()->packets_written != p_res->iterations
+        || sim_controller_stats()->packets_rejected
+        || bench_num_completed - completed != p_res->iterations)
+        p_res->failures++;
+
+    p_res->allocations = bench_allocations();
+}
+
+/*
+ * The simulated controller fills the shared memory RX ring, only
+ * iso_dhm_shm_poll delivering it to the v2 callback is timed.
+ */
+static void bench_rx_shm(bench_result_t *p_res)
+{
+    uint8_t csc[ISO_DHM_SHM_CSC_LEN];
+    uint16_t psn = 0;
+    uint32_t done = 0;
+
+    sim_controller_reset(BENCH_CIS_CONN_HANDLE);
+    bench_rx_bytes = 0;
+
+    if (!sim_controller_shm_attach(WICED_FALSE, csc, iso_dhm_shm_get_csc(WICED_FALSE, csc)))
+    {
+        p_res->failures++;
+        return;
+    }
+
+    while (done < p_res->iterations)
+    {
+        uint32_t batch = p_res->iterations - done;
+        uint64_t start;
+        uint32_t i;
+
+        if (batch > ISO_DHM_SHM_RING_SLOTS)
+            batch = ISO_DHM_SHM_RING_SLOTS;
+
+        for (i = 0; i < batch; i++)
+        {
+            if (!sim_controller_shm_inject_rx(BENCH_CIS_CONN_HANDLE, psn++,
+                                              ISO_DHM_PKT_STATUS_VALID, p_res->sdu_size))
+                p_res->failures++;
+        }
+
+        start = bench_now_ns();
+        if (iso_dhm_shm_poll() != batch)
+            p_res->failures++;
+        p_res->elapsed_ns += bench_now_ns() - start;
+
+        done += batch;
+    }
+
+    if (bench_rx_bytes != (uint32_t)(p_res->sdu_size * p_res->iterations))
+        p_res->failures++;
+
+    p_res->allocations = bench_allocations();
+}
+
+static void bench_nocp(bench_result_t *p_res)
+{
+    uint8_t evt[5];
+    uint64_t start;
+    uint32_t i;
+
+    sim_controller_reset(BENCH_CIS_CONN_HANDLE);
+    bench_num_completed = 0;
+
+    sim_controller_build_num_completed_evt(evt, BENCH_CIS_CONN_HANDLE, 1);
+
+    start = bench_now_ns();
+    for (i = 0; i < p_res->iterations; i++)
+    {
+        if (!iso_dhm_process_num_completed_pkts(evt))
+            p_res->failures++;
+    }
+    p_res->elapsed_ns = bench_now_ns() - start;
+
+    if (bench_num_completed != p_res->iterations)
+        p_res->failures++;
+
+    // a handle never marked valid is not passed on
+    sim_controller_build_num_completed_evt(evt, BENCH_CIS_CONN_HANDLE + 1, 1);
+    if (iso_dhm_process_num_completed_pkts(evt) || bench_num_completed != p_res->iterations)
+        p_res->failures++;
+
+    p_res->allocations = bench_allocations();
+}
+
+/*
+ * Not timed: sending one SDU more than the controller has credits for must
+ * be refused by the data handler, not the controller, and the credits
+ * available callback must fire once Number Of Completed Packets returns them.
+ */
+static uint32_t bench_check_credits(void)
+{
+    uint8_t total = iso_dhm_get_buffer_info()->total_num_iso_data_packets;
+    iso_dhm_handle_stats_t stats;
+    iso_dhm_latency_hist_t hist_before, hist;
+    uint32_t failures = 0;
+    uint32_t timed = 0;
+    uint16_t psn;
+    uint8_t *p_buf;
+    int i;
+
+    sim_controller_reset(BENCH_CIS_CONN_HANDLE);
+    iso_dhm_get_latency_histogram(BENCH_CIS_CONN_HANDLE, &hist_before);
+    bench_credits_cb_count = 0;
+    iso_dhm_register_credits_cb(bench_credits_cb);
+
+    for (psn = 0; psn <= total; psn++)
+    {
+        if ((p_buf = iso_dhm_get_data_buffer_for_handle(BENCH_CIS_CONN_HANDLE)) == NULL)
+        {
+            // the pool may be smaller than the credit window, return what was sent
+            sim_controller_complete();
+            p_buf = iso_dhm_get_data_buffer_for_handle(BENCH_CIS_CONN_HANDLE);
+        }
+        if (!p_buf)
+            return failures + 1;
+        iso_dhm_send_packet(psn, BENCH_CIS_CONN_HANDLE, 0, p_buf, 8);
+        if (!iso_dhm_get_credits())
+            break;
+    }
+
+    if ((p_buf = iso_dhm_get_data_buffer_for_handle(BENCH_CIS_CONN_HANDLE)) == NULL
+        || iso_dhm_send_packet(psn, BENCH_CIS_CONN_HANDLE, 0, p_buf, 8))
+        failures++;
+    if (sim_controller_stats()->packets_rejected || bench_credits_cb_count)
+        failures++;
+
+    sim_controller_complete();
+    if (bench_credits_cb_count != 1 || iso_dhm_get_credits() != total)
+        failures++;
+
+    if (!iso_dhm_get_handle_stats(BENCH_CIS_CONN_HANDLE, &stats) || stats.credits_in_flight
+        || !stats.credit_starvations)
+        failures++;
+
+    // every packet sent here was completed and lands in the latency histogram
+    if (!iso_dhm_get_latency_histogram(BENCH_CIS_CONN_HANDLE, &hist))
+        failures++;
+    for (i = 0; i < ISO_DHM_LATENCY_BUCKETS; i++)
+        timed += hist.bucket[i] - hist_before.bucket[i];
+    if (timed + hist.untimed - hist_before.untimed != (uint32_t)psn + 1)
+        failures++;
+
+    iso_dhm_register_credits_cb(NULL);
+    printf("%-24s %8u %8u %3u %10s %12s %8u\n", "credit flow control",
+           iso_dhm_get_buffer_info()->iso_data_packet_len, 8, 0, "-", "-", failures);
+    return failures;
+}
+
+/*
+ * Not timed: one segmented SDU fanned out three times from a single buffer
+ * must reach the controller three times, leave the SDU bytes untouched for
+ * the extra reference held here and then go back to the slab.
+ */
+static uint32_t bench_check_fanout(void)
+{
+    static const uint16_t handles[] = { BENCH_CIS_CONN_HANDLE, BENCH_CIS_CONN_HANDLE,
+                                        BENCH_CIS_CONN_HANDLE };
+    uint16_t sdu_len = 100;
+    uint16_t num_pkts = iso_dhm_get_num_packets(0, sdu_len);
+    uint32_t failures = 0;
+    iso_dhm_slab_stats_t slab;
+    uint8_t *p_buf;
+    uint16_t i;
+
+    sim_controller_reset(BENCH_CIS_CONN_HANDLE);
+
+    if ((p_buf = iso_dhm_get_data_buffer_for_handle(BENCH_CIS_CONN_HANDLE)) == NULL
+        || !iso_dhm_ref_data_buffer(p_buf))
+        return 1;
+    for (i = 0; i < sdu_len; i++)
+        p_buf[i] = (uint8_t)i;
+
+    // with 64 byte ISO data packets the SDU goes out as 2 fragments per handle
+    if (iso_dhm_send_packet_fanout(0, handles, 3, 0, p_buf, sdu_len) != 3
+        || sim_controller_stats()->packets_written != 3u * num_pkts)
+        failures++;
+    sim_controller_complete();
+
+    for (i = 0; i < sdu_len; i++)
+    {
+        if (p_buf[i] != (uint8_t)i)
+        {
+            failures++;
+            break;
+        }
+    }
+
+    iso_dhm_get_slab_stats(&slab);
+    if (!slab.live)
+        failures++;
+    iso_dhm_free_data_buffer(p_buf);
+    iso_dhm_get_slab_stats(&slab);
+    if (slab.live)
+        failures++;
+
+    printf("%-24s %8u %8u %3u %10s %12s %8u\n", "shared buffer fan-out",
+           iso_dhm_get_buffer_info()->iso_data_packet_len, sdu_len, 0, "-", "-", failures);
+    return failures;
+}
+
+/*
+ * Not timed: complete SDUs whose header claims more than the packet carries,
+ * or more than a slab slot holds, must be dropped and counted, never copied
+ * into the jitter buffer.
+ */
+static uint32_t bench_check_rx_oversize(void)
+{
+    static uint8_t pkt[BENCH_OVERSIZE_SDU_LEN + 12];
+    iso_dhm_handle_stats_t before, after;
+    iso_dhm_slab_stats_t slab;
+    uint32_t failures = 0;
+    uint32_t pkt_len;
+
+    sim_controller_reset(BENCH_CIS_CONN_HANDLE);
+    bench_rx_bytes = 0;
+    iso_dhm_get_handle_stats(BENCH_CIS_CONN_HANDLE, &before);
+    if (!iso_dhm_enable_jitter_buffer(BENCH_CIS_CONN_HANDLE, BENCH_JB_DEPTH, bench_lost_cb))
+        return 1;
+
+    // a real 1500 byte SDU, over max_sdu_len and the slab slot size
+    pkt_len = sim_controller_build_rx_packet(pkt, BENCH_CIS_CONN_HANDLE, 0, 1,
+                                             BENCH_OVERSIZE_SDU_LEN);
+    sim_controller_inject_rx(pkt, pkt_len);
+
+    // 100 bytes of data under a header claiming 1500
+    pkt_len = sim_controller_build_rx_packet(pkt, BENCH_CIS_CONN_HANDLE, 0, 2, 100);
+    pkt[6] = (uint8_t)BENCH_OVERSIZE_SDU_LEN;
+    pkt[7] = (uint8_t)(BENCH_OVERSIZE_SDU_LEN >> 8);
+    sim_controller_inject_rx(pkt, pkt_len);
+
+    iso_dhm_disable_jitter_buffer(BENCH_CIS_CONN_HANDLE);
+
+    iso_dhm_get_handle_stats(BENCH_CIS_CONN_HANDLE, &after);
+    if (bench_rx_bytes || (after.oversize - before.oversize != 1)
+        || (after.rx_malformed - before.rx_malformed != 1))
+        failures++;
+    iso_dhm_get_slab_stats(&slab);
+    if (slab.live)
+        failures++;
+
+    printf("%-24s %8u %8u %3u %10s %12s %8u\n", "oversize RX SDU",
+           iso_dhm_get_buffer_info()->iso_data_packet_len, BENCH_OVERSIZE_SDU_LEN, 0,
+           "-", "-", failures);
+    return failures;
+}
+
+/*
+ * Not timed: with no buffers reserved by any handle, as in the BIG builds,
+ * shared buffers allocated for a handle must still be given back to its
+ * shared_in_use count when freed.
+ */
+static uint32_t bench_check_shared_quota(void)
+{
+    uint8_t *p_bufs[BENCH_RESERVED_SDU_BUFS];
+    iso_dhm_handle_stats_t stats;
+    uint32_t failures = 0;
+    uint8_t n = 0;
+    uint8_t i;
+
+    if (!iso_dhm_add_handle(BENCH_CIS_CONN_HANDLE, 0)
+        || !iso_dhm_add_handle(BENCH_BIS_CONN_HANDLE, 0))
+        return 1;
+
+    while ((n < BENCH_RESERVED_SDU_BUFS)
+           && (p_bufs[n] = iso_dhm_get_data_buffer_for_handle(BENCH_BIS_CONN_HANDLE)) != NULL)
+        n++;
+    if ((n != BENCH_RESERVED_SDU_BUFS) || !iso_dhm_get_handle_stats(BENCH_BIS_CONN_HANDLE, &stats)
+        || (stats.shared_in_use != n) || stats.reserved_in_use)
+        failures++;
+
+    for (i = 0; i < n; i++)
+        iso_dhm_free_data_buffer(p_bufs[i]);
+    if (!iso_dhm_get_handle_stats(BENCH_BIS_CONN_HANDLE, &stats) || stats.shared_in_use)
+        failures++;
+
+    iso_dhm_remove_handle(BENCH_BIS_CONN_HANDLE);
+    if (!iso_dhm_add_handle(BENCH_CIS_CONN_HANDLE, BENCH_RESERVED_SDU_BUFS))
+        failures++;
+
+    printf("%-24s %8u %8u %3u %10s %12s %8u\n", "shared buffer quota",
+           iso_dhm_get_buffer_info()->iso_data_packet_len, 0, 0, "-", "-", failures);
+    return failures;
+}
+
+static void bench_report(const bench_result_t *p_res)
+{
+    printf("%-24s %8u %8u %3u %10.1f %12.3f %8u\n",
+           p_res->name, iso_dhm_get_buffer_info()->iso_data_packet_len,
+           p_res->sdu_size, p_res->ts_flag,
+           (double)p_res->elapsed_ns / p_res->iterations,
+           (double)p_res->allocations / p_res->iterations,
+           p_res->failures);
+}
+
+/******************************************************************************
+ * public functions
+ ******************************************************************************/
+int main(int argc, char *argv[])
+{
+    uint32_t iterations = BENCH_DEFAULT_ITERATIONS;
+    uint32_t failures = 0;
+    size_t p, s;
+    uint8_t ts_flag;
+
+    if (argc > 1)
+        iterations = (uint32_t)strtoul(argv[1], NULL, 0);
+    if (!iterations)
+        iterations = BENCH_DEFAULT_ITERATIONS;
+
+    printf("%-24s %8s %8s %3s %10s %12s %8s\n",
+           "function", "pkt_len", "sdu_len", "ts", "ns/SDU", "allocs/SDU", "failures");
+
+    for (p = 0; p < sizeof(bench_iso_data_packet_lens) / sizeof(bench_iso_data_packet_lens[0]); p++)
+    {
+        sim_controller_set_iso_buffers(bench_iso_data_packet_lens[p],
+                                       SIM_CONTROLLER_ISO_DATA_PACKET_BUFS);
+        iso_dhm_init(&bench_isoc_cfg, bench_num_complete_cb, bench_rx_cb);
+        iso_dhm_add_handle(BENCH_CIS_CONN_HANDLE, BENCH_RESERVED_SDU_BUFS);
+        iso_dhm_set_handle_valid(BENCH_CIS_CONN_HANDLE, WICED_TRUE);
+        iso_dhm_set_tx_time_base(BENCH_CIS_CONN_HANDLE, 0, 0, BENCH_SDU_INTERVAL);
+        sim_controller_set_sdu_interval(BENCH_SDU_INTERVAL);
+
+        for (ts_flag = 0; ts_flag <= 1; ts_flag++)
+        {
+            for (s = 0; s < sizeof(bench_sdu_sizes) / sizeof(bench_sdu_sizes[0]); s++)
+            {
+                bench_result_t res = { "iso_dhm_send_packet", bench_sdu_sizes[s],
+                                       ts_flag, iterations, 0, 0, 0 };
+
+                bench_send(&res);
+                if (res.iterations)
+                {
+                    bench_report(&res);
+                    failures += res.failures;
+                }
+            }
+        }
+
+        for (ts_flag = 0; ts_flag <= 1; ts_flag++)
+        {
+            for (s = 0; s < sizeof(bench_sdu_sizes) / sizeof(bench_sdu_sizes[0]); s++)
+            {
+                bench_result_t res = { "iso_dhm_send_burst", bench_sdu_sizes[s],
+                                       ts_flag, iterations, 0, 0, 0 };
+
+                bench_send_burst(&res);
+                if (res.iterations)
+                {
+                    bench_report(&res);
+                    failures += res.failures;
+                }
+            }
+        }
+
+        for (ts_flag = 0; ts_flag <= 1; ts_flag++)
+        {
+            for (s = 0; s < sizeof(bench_sdu_sizes) / sizeof(bench_sdu_sizes[0]); s++)
+            {
+                bench_result_t res = { "iso_dhm_send_packet_sg", bench_sdu_sizes[s],
+                                       ts_flag, iterations, 0, 0, 0 };
+
+                bench_send_sg(&res);
+                if (res.iterations)
+                {
+                    bench_report(&res);
+                    failures += res.failures;
+                }
+            }
+        }
+    }
+
+    for (ts_flag = 0; ts_flag <= 1; ts_flag++)
+    {
+        for (s = 0; s < sizeof(bench_sdu_sizes) / sizeof(bench_sdu_sizes[0]); s++)
+        {
+            bench_result_t res = { "iso_dhm_process_rx", bench_sdu_sizes[s],
+                                   ts_flag, iterations, 0, 0, 0 };
+
+            bench_rx(&res);
+            bench_report(&res);
+            failures += res.failures;
+        }
+    }
+
+    // the remaining RX cases deliver through the v2 callback only
+    iso_dhm_init(&bench_isoc_cfg, bench_num_complete_cb, NULL);
+    iso_dhm_register_rx_v2_cb(bench_rx_v2_cb);
+
+    for (ts_flag = 0; ts_flag <= 1; ts_flag++)
+    {
+        for (s = 0; s < sizeof(bench_sdu_sizes) / sizeof(bench_sdu_sizes[0]); s++)
+        {
+            bench_result_t res = { "iso_dhm_process_rx_v2", bench_sdu_sizes[s],
+                                   ts_flag, iterations, 0, 0, 0 };
+
+            bench_rx(&res);
+            bench_report(&res);
+            failures += res.failures;
+        }
+    }
+
+    for (ts_flag = 0; ts_flag <= 1; ts_flag++)
+    {
+        for (s = 0; s < sizeof(bench_sdu_sizes) / sizeof(bench_sdu_sizes[0]); s++)
+        {
+            bench_result_t res = { "iso_dhm_process_rx_frag", bench_sdu_sizes[s],
+                                   ts_flag, iterations, 0, 0, 0 };
+
+            bench_rx_fragmented(&res);
+            if (res.iterations)
+            {
+                bench_report(&res);
+                failures += res.failures;
+            }
+        }
+    }
+
+    for (s = 0; s < sizeof(bench_sdu_sizes) / sizeof(bench_sdu_sizes[0]); s++)
+    {
+        bench_result_t res = { "iso_dhm_process_rx_jb", bench_sdu_sizes[s],
+                               0, iterations, 0, 0, 0 };
+
+        bench_rx_jitter(&res);
+        bench_report(&res);
+        failures += res.failures;
+    }
+
+    for (s = 0; s < sizeof(bench_sdu_sizes) / sizeof(bench_sdu_sizes[0]); s++)
+    {
+        bench_result_t res = { "iso_dhm_process_rx_mux", bench_sdu_sizes[s],
+                               0, iterations, 0, 0, 0 };
+
+        bench_rx_mux(&res);
+        if (res.iterations)
+        {
+            bench_report(&res);
+            failures += res.failures;
+        }
+    }
+
+    for (s = 0; s < sizeof(bench_sdu_sizes) / sizeof(bench_sdu_sizes[0]); s++)
+    {
+        bench_result_t res = { "iso_dhm_process_rx_demux", bench_sdu_sizes[s],
+                               0, iterations, 0, 0, 0 };
+
+        bench_rx_demux(&res);
+        bench_report(&res);
+        failures += res.failures;
+    }
+
+    for (ts_flag = 0; ts_flag <= 1; ts_flag++)
+    {
+        for (s = 0; s < sizeof(bench_sdu_sizes) / sizeof(bench_sdu_sizes[0]); s++)
+        {
+            bench_result_t res = { "iso_dhm_shm_send", bench_sdu_sizes[s],
+                                   ts_flag, iterations, 0, 0, 0 };
+
+            bench_send_shm(&res);
+            bench_report(&res);
+            failures += res.failures;
+        }
+    }
+
+    for (s = 0; s < sizeof(bench_sdu_sizes) / sizeof(bench_sdu_sizes[0]); s++)
+    {
+        bench_result_t res = { "iso_dhm_shm_poll_rx", bench_sdu_sizes[s],
+                               0, iterations, 0, 0, 0 };
+
+        bench_rx_shm(&res);
+        bench_report(&res);
+        failures += res.failures;
+    }
+
+    {
+        bench_result_t res = { "iso_dhm_process_nocp", 0, 0, iterations, 0, 0, 0 };
+
+        bench_nocp(&res);
+        bench_report(&res);
+        failures += res.failures;
+    }
+
+    failures += bench_check_credits();
+    failures += bench_check_fanout();
+    failures += bench_check_rx_oversize();
+    failures += bench_check_shared_quota();
+
+    // every SDU buffer must be back in the slab
+    {
+        iso_dhm_slab_stats_t slab;
+
+        iso_dhm_get_slab_stats(&slab);
+        printf("\nSDU slab: slot_size %u slots %u live %u peak %u failed %u\n",
+               slab.slot_size, slab.slot_count, slab.live, slab.peak, slab.failed);
+        if (slab.live)
+            failures++;
+    }
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,308 @@
+/*
+ * $ Copyright YEAR Cypress Semiconductor $
+ */
+/*
+ * replay.c
+ *
+ * Feeds the received HCI ISO data packets of a btsnoop capture (e.g. one
+ * dumped by iso_dhm_capture_dump) back through iso_dhm_process_rx_data and
+ * reports what the data handler made of them.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "wiced_bt_cfg.h"
+#include "iso_data_handler.h"
+#include "sim_controller.h"
+
+/******************************************************************************
+ *  defines
+ ******************************************************************************/
+#define REPLAY_MAX_SDU_SIZE         ISO_DHM_SLAB_SDU_SIZE
+#define REPLAY_MAX_HANDLES          4
+
+#define BTSNOOP_FILE_HDR_SIZE       16
+#define BTSNOOP_RECORD_HDR_SIZE     24
+#define BTSNOOP_DATALINK_H4         1002
+#define BTSNOOP_FLAG_RECEIVED       1
+#define H4_ISO_DATA                 0x05
+#define ISO_HANDLE_MASK             0x0FFF
+
+/******************************************************************************
+ *  local variables
+ ******************************************************************************/
+static const wiced_bt_cfg_isoc_t replay_isoc_cfg = {
+    .max_sdu_size = REPLAY_MAX_SDU_SIZE,
+    .channel_count = 1,
+    .max_cis_conn = 1,
+    .max_cig_count = 1,
+    .max_buffers_per_cis = 4,
+    .max_big_count = 0
+};
+
+static struct
+{
+    uint32_t packets;                       // ISO packets replayed
+    uint32_t skipped_sent;                  // host to controller packets, not replayed
+    uint32_t skipped_other;                 // truncated or not ISO data
+    uint32_t sdus;                          // SDUs delivered by the data handler
+    uint64_t sdu_bytes;
+    uint64_t busy_ns;                       // time spent in iso_dhm_process_rx_data
+    uint16_t handles[REPLAY_MAX_HANDLES];
+    uint8_t num_handles;
+} replay;
+
+static FILE *replay_out;
+
+/******************************************************************************
+ * private functions
+ ******************************************************************************/
+static uint64_t replay_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint32_t replay_be32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void replay_rx_v2_cb(const iso_dhm_rx_meta_t *p_meta, uint8_t *p_data)
+{
+    (void)p_data;
+    replay.sdus++;
+    replay.sdu_bytes += p_meta->sdu_len;
+}
+
+static void replay_num_complete_cb(uint16_t conn_handle, uint16_t num_sent)
+{
+    (void)conn_handle;
+    (void)num_sent;
+}
+
+static void replay_capture_write(const uint8_t *p_data, uint32_t len)
+{
+    fwrite(p_data, 1, len, replay_out);
+}
+
+/* Registers each handle on first sight so the data handler keeps its stats */
+static void replay_add_handle(uint16_t handle)
+{
+    uint8_t i;
+
+    for (i = 0; i < replay.num_handles; i++)
+    {
+        if (replay.handles[i] == handle)
+            return;
+    }
+    if (replay.num_handles == REPLAY_MAX_HANDLES)
+        return;
+
+    replay.handles[replay.num_handles++] = handle;
+    iso_dhm_add_handle(handle, 0);
+    iso_dhm_set_handle_valid(handle, WICED_TRUE);
+}
+
+static uint8_t *replay_load(const char *p_path, size_t *p_len)
+{
+    uint8_t *p_file;
+    long len;
+    FILE *f;
+
+    if ((f = fopen(p_path, "rb")) == NULL)
+    {
+        perror(p_path);
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    if ((len <= 0) || ((p_file = malloc((size_t)len)) == NULL)
+        || (fread(p_file, 1, (size_t)len, f) != (size_t)len))
+    {
+        fprintf(stderr, "%s: read failed\n", p_path);
+        fclose(f);
+        return NULL;
+    }
+    fclose(f);
+
+    *p_len = (size_t)len;
+    return p_file;
+}
+
+/*
+ * speed 0 replays back to back, otherwise packets are spaced by their
+ * capture time stamps divided by speed.
+ */
+static int replay_run(const uint8_t *p_file, size_t len, double speed)
+{
+    const uint8_t *p = p_file + BTSNOOP_FILE_HDR_SIZE;
+    const uint8_t *p_end = p_file + len;
+    uint64_t first_ts = 0;
+    uint64_t start_ns = replay_now_ns();
+    uint64_t t0;
+    int first = 1;
+
+    if ((len < BTSNOOP_FILE_HDR_SIZE) || memcmp(p_file, "btsnoop", 8)
+        || (replay_be32(p_file + 12) != BTSNOOP_DATALINK_H4))
+    {
+        fprintf(stderr, "not a btsnoop H4 capture\n");
+        return -1;
+    }
+
+    while (p + BTSNOOP_RECORD_HDR_SIZE <= p_end)
+    {
+        uint32_t orig_len = replay_be32(p);
+        uint32_t incl_len = replay_be32(p + 4);
+        uint32_t flags = replay_be32(p + 8);
+        uint64_t ts = ((uint64_t)replay_be32(p + 16) << 32) | replay_be32(p + 20);
+        uint8_t *p_pkt = (uint8_t *)p + BTSNOOP_RECORD_HDR_SIZE;
+
+        if (p_pkt + incl_len > p_end)
+            break;
+        p = p_pkt + incl_len;
+
+        if (!(flags & BTSNOOP_FLAG_RECEIVED))
+        {
+            replay.skipped_sent++;
+            continue;
+        }
+        if ((incl_len != orig_len) || (incl_len < 5) || (p_pkt[0] != H4_ISO_DATA))
+        {
+            replay.skipped_other++;
+            continue;
+        }
+
+        if (first)
+        {
+            first_ts = ts;
+            first = 0;
+        }
+        else if (speed > 0)
+        {
+            uint64_t due_ns = start_ns + (uint64_t)((double)(ts - first_ts) * 1000.0 / speed);
+            uint64_t now_ns = replay_now_ns();
+
+            if (due_ns > now_ns)
+            {
+                struct timespec wait = { (time_t)((due_ns - now_ns) / 1000000000ull),
+                                         (long)((due_ns - now_ns) % 1000000000ull) };
+
+                nanosleep(&wait, NULL);
+            }
+        }
+
+        replay_add_handle((uint16_t)((p_pkt[1] | (p_pkt[2] << 8)) & ISO_HANDLE_MASK));
+
+        t0 = replay_now_ns();
+        sim_controller_inject_rx(p_pkt + 1, incl_len - 1);
+        replay.busy_ns += replay_now_ns() - t0;
+        replay.packets++;
+    }
+
+    return 0;
+}
+
+static void replay_report(void)
+{
+    iso_dhm_handle_stats_t stats;
+    uint8_t i;
+
+    printf("packets %u  sdus %u  sdu_bytes %llu  ns/packet %.1f"
+           "  skipped_sent %u  skipped_other %u\n",
+           replay.packets, replay.sdus, (unsigned long long)replay.sdu_bytes,
+           replay.packets ? (double)replay.busy_ns / replay.packets : 0.0,
+           replay.skipped_sent, replay.skipped_other);
+
+    for (i = 0; i < replay.num_handles; i++)
+    {
+        if (!iso_dhm_get_handle_stats(replay.handles[i], &stats))
+            continue;
+
+        printf("handle 0x%03x  rx_packets %u  valid %u  possibly_invalid %u  lost %u"
+               "  missing %u  zero_len %u  oversize %u  malformed %u  alloc_failures %u\n",
+               replay.handles[i], stats.rx_packets, stats.rx_valid,
+               stats.rx_possibly_invalid, stats.rx_lost, stats.rx_missing,
+               stats.rx_zero_len, stats.oversize, stats.rx_malformed,
+               stats.alloc_failures);
+    }
+}
+
+static void replay_usage(const char *p_name)
+{
+    fprintf(stderr,
+            "usage: %s [-s speed] [-o capture.btsnoop] file.btsnoop\n"
+            "  -s speed  0 replays back to back (default), 1 at the captured timing,\n"
+            "            N N times faster\n"
+            "  -o file   writes what the data handler captured during the replay\n",
+            p_name);
+}
+
+/******************************************************************************
+ * public functions
+ ******************************************************************************/
+int main(int argc, char *argv[])
+{
+    const char *p_out_path = NULL;
+    double speed = 0;
+    uint8_t *p_file;
+    size_t len;
+    int opt;
+    int rc;
+
+    while ((opt = getopt(argc, argv, "s:o:")) != -1)
+    {
+        switch (opt)
+        {
+        case 's':
+            speed = strtod(optarg, NULL);
+            break;
+        case 'o':
+            p_out_path = optarg;
+            break;
+        default:
+            replay_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc - 1)
+    {
+        replay_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if ((p_file = replay_load(argv[optind], &len)) == NULL)
+        return EXIT_FAILURE;
+
+    iso_dhm_init(&replay_isoc_cfg, replay_num_complete_cb, NULL);
+    iso_dhm_register_rx_v2_cb(replay_rx_v2_cb);
+    iso_dhm_capture_enable(p_out_path != NULL);
+
+    rc = replay_run(p_file, len, speed);
+    free(p_file);
+    if (rc)
+        return EXIT_FAILURE;
+
+    replay_report();
+
+    if (p_out_path)
+    {
+        if ((replay_out = fopen(p_out_path, "wb")) == NULL)
+        {
+            perror(p_out_path);
+            return EXIT_FAILURE;
+        }
+        printf("captured %u packets to %s\n", iso_dhm_capture_dump(replay_capture_write), p_out_path);
+        fclose(replay_out);
+    }
+
+    return EXIT_SUCCESS;
+}
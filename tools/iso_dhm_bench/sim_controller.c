@@ -0,0 +1,460 @@
+/*
+ * $ Copyright YEAR Cypress Semiconductor $
+ */
+/*
+ * sim_controller.c
+ *
+ * Host implementation of the btstack ISOC data path and buffer pool calls
+ * used by the ISO data handler.
+ */
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "wiced_bt_dev.h"
+#include "wiced_bt_isoc.h"
+#include "wiced_memory.h"
+#include "wiced_timer.h"
+#include "iso_data_handler.h"
+#include "sim_controller.h"
+
+/******************************************************************************
+ *  defines
+ ******************************************************************************/
+#define SIM_ISO_DATA_HEADER_SIZE    4
+#define SIM_ISO_LOAD_HEADER_SIZE    4
+#define SIM_ISO_TS_SIZE             4
+#define SIM_ISO_PB_FLAG_FIRST       0
+#define SIM_ISO_PB_FLAG_CONTINUATION 1
+#define SIM_ISO_PB_FLAG_COMPLETE    2
+#define SIM_ISO_PB_FLAG_LAST        3
+#define SIM_ISO_PB_FLAG_OFFSET      12
+#define SIM_ISO_TS_FLAG_OFFSET      14
+#define SIM_ISO_HANDLE_MASK         0x0FFF
+#define SIM_ISO_DATA_LOAD_LEN_MASK  0x3FFF
+
+#define SIM_HCI_LE_READ_BUFFER_SIZE_V2  0x2060
+#define SIM_HCI_ACL_DATA_PACKET_LEN     251
+#define SIM_HCI_NUM_ACL_DATA_PACKETS    8
+
+/******************************************************************************
+ *  local variables
+ ******************************************************************************/
+typedef struct sim_buffer_hdr
+{
+    struct sim_buffer_hdr   *p_next;
+    wiced_bt_buffer_t       *p_pool;
+} sim_buffer_hdr_t;
+
+struct wiced_bt_buffer
+{
+    sim_buffer_hdr_t        *p_free;
+    uint32_t                buffer_size;
+    uint32_t                buffer_cnt;
+};
+
+static struct
+{
+    wiced_ble_isoc_rx_data_cb_t         rx_cb;
+    wiced_ble_isoc_num_complete_cb_t    num_complete_cb;
+    uint16_t                            cis_conn_handle;
+    uint16_t                            outstanding;
+    uint16_t                            iso_data_packet_len;
+    uint8_t                             total_num_iso_data_packets;
+    uint32_t                            sdu_interval;
+    sim_controller_stats_t              stats;
+#ifdef ISO_DHM_SHM_DATA_PATH
+    iso_dhm_shm_ring_t                  *p_shm_tx;      // consumed here
+    iso_dhm_shm_ring_t                  *p_shm_rx;      // produced here
+#endif
+} sim = {
+    .iso_data_packet_len = SIM_CONTROLLER_ISO_DATA_PACKET_LEN,
+    .total_num_iso_data_packets = SIM_CONTROLLER_ISO_DATA_PACKET_BUFS,
+};
+
+/******************************************************************************
+ * btstack stand-ins
+ ******************************************************************************/
+uint64_t clock_SystemTimeMicroseconds64(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+wiced_bt_buffer_t *wiced_bt_create_pool(const char *name, uint32_t buffer_size,
+                                        uint32_t buffer_cnt, void *p_heap)
+{
+    uint32_t stride = sizeof(sim_buffer_hdr_t) + ((buffer_size + 7) & ~7u);
+    wiced_bt_buffer_t *p_pool = malloc(sizeof(*p_pool) + stride * buffer_cnt);
+    uint8_t *p_mem;
+    uint32_t i;
+
+    (void)name;
+    (void)p_heap;
+
+    if (!p_pool)
+        return NULL;
+
+    p_pool->p_free = NULL;
+    p_pool->buffer_size = buffer_size;
+    p_pool->buffer_cnt = buffer_cnt;
+
+    p_mem = (uint8_t *)(p_pool + 1);
+    for (i = 0; i < buffer_cnt; i++)
+    {
+        sim_buffer_hdr_t *p_hdr = (sim_buffer_hdr_t *)(p_mem + i * stride);
+
+        p_hdr->p_pool = p_pool;
+        p_hdr->p_next = p_pool->p_free;
+        p_pool->p_free = p_hdr;
+    }
+
+    sim.stats.pools_created++;
+    return p_pool;
+}
+
+void *wiced_bt_get_buffer_from_pool(wiced_bt_buffer_t *p_pool)
+{
+    sim_buffer_hdr_t *p_hdr;
+
+    if (!p_pool || !p_pool->p_free)
+    {
+        sim.stats.allocation_failures++;
+        return NULL;
+    }
+
+    p_hdr = p_pool->p_free;
+    p_pool->p_free = p_hdr->p_next;
+    sim.stats.buffers_allocated++;
+
+    return p_hdr + 1;
+}
+
+void wiced_bt_free_buffer(void *p_buf)
+{
+    sim_buffer_hdr_t *p_hdr = (sim_buffer_hdr_t *)p_buf - 1;
+    wiced_bt_buffer_t *p_pool = p_hdr->p_pool;
+
+    p_hdr->p_next = p_pool->p_free;
+    p_pool->p_free = p_hdr;
+    sim.stats.buffers_freed++;
+}
+
+void wiced_ble_isoc_register_data_cb(wiced_ble_isoc_rx_data_cb_t rx_cb,
+                                     wiced_ble_isoc_num_complete_cb_t num_complete_cb)
+{
+    sim.rx_cb = rx_cb;
+    sim.num_complete_cb = num_complete_cb;
+}
+
+wiced_bool_t wiced_ble_isoc_write_data_to_lower(uint8_t *p_data, uint32_t len)
+{
+    uint16_t handle_and_flags;
+    uint16_t data_load_length;
+    uint8_t pb_flag;
+    uint32_t ts = 0;
+    uint16_t psn = 0;
+
+    STREAM_TO_UINT16(handle_and_flags, p_data);
+    STREAM_TO_UINT16(data_load_length, p_data);
+
+    // a time stamped SDU must be due at the ISO event of its PSN
+    pb_flag = (handle_and_flags >> SIM_ISO_PB_FLAG_OFFSET) & 0x03;
+    if ((handle_and_flags & (1 << SIM_ISO_TS_FLAG_OFFSET))
+        && (pb_flag == SIM_ISO_PB_FLAG_FIRST || pb_flag == SIM_ISO_PB_FLAG_COMPLETE))
+    {
+        STREAM_TO_UINT32(ts, p_data);
+        STREAM_TO_UINT16(psn, p_data);
+    }
+
+    if ((handle_and_flags & SIM_ISO_HANDLE_MASK) != sim.cis_conn_handle
+        || (uint32_t)data_load_length + SIM_ISO_DATA_HEADER_SIZE != len
+        || (data_load_length & SIM_ISO_DATA_LOAD_LEN_MASK) > sim.iso_data_packet_len
+        || sim.outstanding >= sim.total_num_iso_data_packets
+        || (sim.sdu_interval && ts != (uint32_t)((int32_t)(int16_t)psn * (int32_t)sim.sdu_interval)))
+    {
+        sim.stats.packets_rejected++;
+        return WICED_FALSE;
+    }
+
+    sim.outstanding++;
+    sim.stats.packets_written++;
+    sim.stats.bytes_written += len;
+    return WICED_TRUE;
+}
+
+wiced_result_t wiced_bt_dev_vendor_specific_command(uint16_t opcode,
+    uint8_t param_len, uint8_t *p_param_buf,
+    wiced_bt_dev_vendor_specific_command_complete_cback_t *p_cback)
+{
+    wiced_bt_dev_vendor_specific_command_complete_params_t params;
+    uint8_t rsp[7];
+    uint8_t *p = rsp;
+
+    (void)param_len;
+    (void)p_param_buf;
+
+    if (opcode != SIM_HCI_LE_READ_BUFFER_SIZE_V2)
+        return WICED_BT_ERROR;
+
+    UINT8_TO_STREAM(p, WICED_BT_SUCCESS);
+    UINT16_TO_STREAM(p, SIM_HCI_ACL_DATA_PACKET_LEN);
+    UINT8_TO_STREAM(p, SIM_HCI_NUM_ACL_DATA_PACKETS);
+    UINT16_TO_STREAM(p, sim.iso_data_packet_len);
+    UINT8_TO_STREAM(p, sim.total_num_iso_data_packets);
+
+    params.opcode = opcode;
+    params.param_len = (uint16_t)(p - rsp);
+    params.p_param_buf = rsp;
+
+    // the real controller answers later from the stack thread
+    if (p_cback)
+        p_cback(&params);
+
+    return WICED_BT_PENDING;
+}
+
+wiced_bool_t wiced_ble_isoc_is_cis_connected_with_conn_hdl(uint16_t conn_hdl)
+{
+    return conn_hdl == sim.cis_conn_handle;
+}
+
+wiced_bool_t wiced_ble_isoc_is_bis_created(uint16_t conn_hdl)
+{
+    (void)conn_hdl;
+    return WICED_FALSE;
+}
+
+/******************************************************************************
+ * public functions
+ ******************************************************************************/
+void sim_controller_reset(uint16_t cis_conn_handle)
+{
+    memset(&sim.stats, 0, sizeof(sim.stats));
+    sim.cis_conn_handle = cis_conn_handle;
+    sim.outstanding = 0;
+}
+
+void sim_controller_set_iso_buffers(uint16_t iso_data_packet_len,
+                                    uint8_t total_num_iso_data_packets)
+{
+    sim.iso_data_packet_len = iso_data_packet_len;
+    sim.total_num_iso_data_packets = total_num_iso_data_packets;
+}
+
+void sim_controller_set_sdu_interval(uint32_t sdu_interval)
+{
+    sim.sdu_interval = sdu_interval;
+}
+
+const sim_controller_stats_t *sim_controller_stats(void)
+{
+    return &sim.stats;
+}
+
+void sim_controller_complete(void)
+{
+    uint8_t evt[5];
+
+    if (!sim.outstanding || !sim.num_complete_cb)
+        return;
+
+    sim_controller_build_num_completed_evt(evt, sim.cis_conn_handle,
+                                           sim.outstanding);
+    sim.outstanding = 0;
+    sim.num_complete_cb(evt);
+}
+
+uint32_t sim_controller_build_rx_packet(uint8_t *p_pkt, uint16_t conn_handle,
+                                        uint8_t ts_flag, uint16_t psn,
+                                        uint16_t sdu_len)
+{
+    uint8_t *p = p_pkt;
+    uint16_t handle_and_flags = conn_handle
+                                | (SIM_ISO_PB_FLAG_COMPLETE << SIM_ISO_PB_FLAG_OFFSET)
+                                | ((ts_flag ? 1 : 0) << SIM_ISO_TS_FLAG_OFFSET);
+    uint16_t data_load_length = SIM_ISO_LOAD_HEADER_SIZE + sdu_len
+                                + (ts_flag ? SIM_ISO_TS_SIZE : 0);
+    uint16_t i;
+
+    UINT16_TO_STREAM(p, handle_and_flags);
+    UINT16_TO_STREAM(p, data_load_length);
+    if (ts_flag)
+    {
+        UINT32_TO_STREAM(p, (uint32_t)psn * 10000u);
+    }
+    UINT16_TO_STREAM(p, psn);
+    UINT16_TO_STREAM(p, sdu_len);
+    for (i = 0; i < sdu_len; i++)
+    {
+        *p++ = (uint8_t)i;
+    }
+
+    return (uint32_t)(p - p_pkt);
+}
+
+uint32_t sim_controller_build_rx_fragments(uint8_t *p_pkts, uint32_t *p_lens,
+                                           uint32_t max_pkts,
+                                           uint16_t conn_handle,
+                                           uint8_t ts_flag, uint16_t psn,
+                                           uint16_t sdu_len, uint16_t frag_len)
+{
+    uint8_t *p = p_pkts;
+    uint16_t offset = 0;
+    uint32_t n = 0;
+
+    if (!frag_len || sdu_len <= frag_len)
+        return 0;
+
+    while (offset < sdu_len)
+    {
+        uint8_t *p_start = p;
+        uint16_t chunk = sdu_len - offset;
+        uint16_t pb_flag;
+        uint16_t data_load_length;
+        uint16_t i;
+
+        if (n == max_pkts)
+            return 0;
+
+        if (chunk > frag_len)
+            chunk = frag_len;
+
+        if (!offset)
+            pb_flag = SIM_ISO_PB_FLAG_FIRST;
+        else if (offset + chunk < sdu_len)
+            pb_flag = SIM_ISO_PB_FLAG_CONTINUATION;
+        else
+            pb_flag = SIM_ISO_PB_FLAG_LAST;
+
+        data_load_length = chunk;
+        if (!offset)
+            data_load_length += SIM_ISO_LOAD_HEADER_SIZE + (ts_flag ? SIM_ISO_TS_SIZE : 0);
+
+        UINT16_TO_STREAM(p, conn_handle | (pb_flag << SIM_ISO_PB_FLAG_OFFSET)
+                            | ((ts_flag ? 1 : 0) << SIM_ISO_TS_FLAG_OFFSET));
+        UINT16_TO_STREAM(p, data_load_length);
+        if (!offset)
+        {
+            if (ts_flag)
+            {
+                UINT32_TO_STREAM(p, (uint32_t)psn * 10000u);
+            }
+            UINT16_TO_STREAM(p, psn);
+            UINT16_TO_STREAM(p, sdu_len);
+        }
+        for (i = 0; i < chunk; i++)
+        {
+            *p++ = (uint8_t)(offset + i);
+        }
+
+        p_lens[n++] = (uint32_t)(p - p_start);
+        offset += chunk;
+    }
+
+    return n;
+}
+
+uint32_t sim_controller_build_num_completed_evt(uint8_t *p_evt,
+                                                uint16_t conn_handle,
+                                                uint16_t num_completed)
+{
+    uint8_t *p = p_evt;
+
+    UINT8_TO_STREAM(p, 1);
+    UINT16_TO_STREAM(p, conn_handle);
+    UINT16_TO_STREAM(p, num_completed);
+
+    return (uint32_t)(p - p_evt);
+}
+
+void sim_controller_inject_rx(uint8_t *p_pkt, uint32_t length)
+{
+    if (sim.rx_cb)
+        sim.rx_cb(p_pkt, length);
+}
+
+#ifdef ISO_DHM_SHM_DATA_PATH
+wiced_bool_t sim_controller_shm_attach(wiced_bool_t input, const uint8_t *p_csc,
+                                       uint8_t csc_len)
+{
+    uintptr_t addr = 0;
+    uint8_t i;
+
+    if ((csc_len != ISO_DHM_SHM_CSC_LEN) || (p_csc[0] != ISO_DHM_SHM_RING_SLOTS)
+        || ((p_csc[1] | (p_csc[2] << 8)) != ISO_DHM_SLAB_SDU_SIZE))
+        return WICED_FALSE;
+
+    for (i = 0; i < sizeof(addr); i++)
+        addr |= (uintptr_t)p_csc[3 + i] << (8 * i);
+
+    if (input)
+        sim.p_shm_tx = (iso_dhm_shm_ring_t *)addr;
+    else
+        sim.p_shm_rx = (iso_dhm_shm_ring_t *)addr;
+    return WICED_TRUE;
+}
+
+uint32_t sim_controller_shm_complete(void)
+{
+    iso_dhm_shm_ring_t *p_ring = sim.p_shm_tx;
+    iso_dhm_shm_slot_t *p_slot;
+    uint32_t head;
+    uint32_t n = 0;
+
+    if (!p_ring)
+        return 0;
+
+    head = p_ring->head;
+    atomic_thread_fence(memory_order_acquire);
+    while (p_ring->tail != head)
+    {
+        p_slot = &p_ring->slot[p_ring->tail & (ISO_DHM_SHM_RING_SLOTS - 1)];
+        if ((p_slot->conn_handle != sim.cis_conn_handle)
+            || (p_slot->sdu_len > ISO_DHM_SLAB_SDU_SIZE)
+            || (sim.sdu_interval && p_slot->ts_valid
+                && (p_slot->ts != (uint32_t)((int32_t)(int16_t)p_slot->psn * (int32_t)sim.sdu_interval))))
+        {
+            sim.stats.packets_rejected++;
+        }
+        else
+        {
+            sim.stats.packets_written++;
+            sim.stats.bytes_written += p_slot->sdu_len;
+        }
+
+        atomic_thread_fence(memory_order_release);
+        p_ring->tail++;
+        n++;
+    }
+    return n;
+}
+
+wiced_bool_t sim_controller_shm_inject_rx(uint16_t conn_handle, uint16_t psn,
+                                          uint8_t packet_status, uint16_t sdu_len)
+{
+    iso_dhm_shm_ring_t *p_ring = sim.p_shm_rx;
+    iso_dhm_shm_slot_t *p_slot;
+
+    if (!p_ring || (p_ring->head - p_ring->tail == ISO_DHM_SHM_RING_SLOTS)
+        || (sdu_len > ISO_DHM_SLAB_SDU_SIZE))
+        return WICED_FALSE;
+
+    atomic_thread_fence(memory_order_acquire);
+    p_slot = &p_ring->slot[p_ring->head & (ISO_DHM_SHM_RING_SLOTS - 1)];
+    p_slot->conn_handle = conn_handle;
+    p_slot->psn = psn;
+    p_slot->ts = 0;
+    p_slot->ts_valid = 0;
+    p_slot->packet_status = packet_status;
+    p_slot->sdu_len = sdu_len;
+
+    atomic_thread_fence(memory_order_release);
+    p_ring->head++;
+    return WICED_TRUE;
+}
+#endif
@@ -0,0 +1,155 @@
+/*
+ * $ Copyright YEAR Cypress Semiconductor $
+ */
+/*
+ * @file sim_controller.h
+ *
+ * @brief Simulated controller used to run the ISO data handler on a host.
+ *        It stands in for the btstack ISOC data path and buffer pools and
+ *        counts every call the data handler makes into them.
+ */
+#ifndef SIM_CONTROLLER_H_
+#define SIM_CONTROLLER_H_
+
+#include "wiced_bt_types.h"
+
+#define SIM_CONTROLLER_ISO_DATA_PACKET_BUFS 6
+#define SIM_CONTROLLER_ISO_DATA_PACKET_LEN  251
+
+typedef struct
+{
+    uint32_t pools_created;
+    uint32_t buffers_allocated;
+    uint32_t buffers_freed;
+    uint32_t allocation_failures;
+    uint32_t packets_written;
+    uint32_t bytes_written;
+    uint32_t packets_rejected;
+} sim_controller_stats_t;
+
+/******************************************************************************
+ * Function Name: sim_controller_reset
+ ******************************************************************************
+ * Summary:
+ *  Resets counters and credits. The connected handle is the only handle the
+ *  simulated controller reports as a valid CIS.
+ *****************************************************************************/
+void sim_controller_reset(uint16_t cis_conn_handle);
+
+/******************************************************************************
+ * Function Name: sim_controller_set_iso_buffers
+ ******************************************************************************
+ * Summary:
+ *  Sets the ISO data packet length and number of ISO data packets reported
+ *  by LE Read Buffer Size v2. The packet count is also the credit window.
+ *****************************************************************************/
+void sim_controller_set_iso_buffers(uint16_t iso_data_packet_len,
+                                    uint8_t total_num_iso_data_packets);
+
+/******************************************************************************
+ * Function Name: sim_controller_set_sdu_interval
+ ******************************************************************************
+ * Summary:
+ *  When not 0, time stamped SDUs are rejected unless their time stamp is
+ *  PSN * sdu_interval, i.e. a time base of PSN 0 at time 0. The PSN is
+ *  taken as signed, so it wraps the way the data handler's PSN offsets do.
+ *****************************************************************************/
+void sim_controller_set_sdu_interval(uint32_t sdu_interval);
+
+/******************************************************************************
+ * Function Name: sim_controller_stats
+ ******************************************************************************
+ * Summary:
+ *  Returns the counters accumulated since the last reset.
+ *****************************************************************************/
+const sim_controller_stats_t *sim_controller_stats(void);
+
+/******************************************************************************
+ * Function Name: sim_controller_complete
+ ******************************************************************************
+ * Summary:
+ *  Returns all outstanding credits by delivering one HCI Number Of Completed
+ *  Packets event through the callback the data handler registered.
+ *****************************************************************************/
+void sim_controller_complete(void);
+
+/******************************************************************************
+ * Function Name: sim_controller_build_rx_packet
+ ******************************************************************************
+ * Summary:
+ *  Builds an HCI ISO data packet as the controller would send it and returns
+ *  its length. p_pkt must hold sdu_len + 12 bytes.
+ *****************************************************************************/
+uint32_t sim_controller_build_rx_packet(uint8_t *p_pkt, uint16_t conn_handle,
+                                        uint8_t ts_flag, uint16_t psn,
+                                        uint16_t sdu_len);
+
+/******************************************************************************
+ * Function Name: sim_controller_build_rx_fragments
+ ******************************************************************************
+ * Summary:
+ *  Builds an SDU as a first fragment, continuation fragments and a last
+ *  fragment of at most frag_len payload bytes each. Packets are written back
+ *  to back into p_pkts with their lengths in p_lens. Returns the number of
+ *  packets, or 0 if max_pkts is too small.
+ *****************************************************************************/
+uint32_t sim_controller_build_rx_fragments(uint8_t *p_pkts, uint32_t *p_lens,
+                                           uint32_t max_pkts,
+                                           uint16_t conn_handle,
+                                           uint8_t ts_flag, uint16_t psn,
+                                           uint16_t sdu_len, uint16_t frag_len);
+
+/******************************************************************************
+ * Function Name: sim_controller_build_num_completed_evt
+ ******************************************************************************
+ * Summary:
+ *  Builds the parameters of an HCI Number Of Completed Packets event for a
+ *  single handle and returns its length.
+ *****************************************************************************/
+uint32_t sim_controller_build_num_completed_evt(uint8_t *p_evt,
+                                                uint16_t conn_handle,
+                                                uint16_t num_completed);
+
+/******************************************************************************
+ * Function Name: sim_controller_inject_rx
+ ******************************************************************************
+ * Summary:
+ *  Delivers a packet through the receive callback the data handler
+ *  registered.
+ *****************************************************************************/
+void sim_controller_inject_rx(uint8_t *p_pkt, uint32_t length);
+
+#ifdef ISO_DHM_SHM_DATA_PATH
+/******************************************************************************
+ * Function Name: sim_controller_shm_attach
+ ******************************************************************************
+ * Summary:
+ *  Stands in for setting up the vendor shared memory data path: finds the
+ *  TX (input) or RX ring from the Codec_Configuration the data handler
+ *  built with iso_dhm_shm_get_csc. Returns WICED_FALSE if it is malformed.
+ *****************************************************************************/
+wiced_bool_t sim_controller_shm_attach(wiced_bool_t input, const uint8_t *p_csc,
+                                       uint8_t csc_len);
+
+/******************************************************************************
+ * Function Name: sim_controller_shm_complete
+ ******************************************************************************
+ * Summary:
+ *  Consumes every SDU in the TX ring, checking it the way HCI ISO packets
+ *  are checked, and returns the number consumed. They are counted as
+ *  packets written or rejected.
+ *****************************************************************************/
+uint32_t sim_controller_shm_complete(void);
+
+/******************************************************************************
+ * Function Name: sim_controller_shm_inject_rx
+ ******************************************************************************
+ * Summary:
+ *  Places a received SDU in the RX ring. The SDU bytes are left as the
+ *  slot held them. Returns WICED_FALSE if the ring is full.
+ *****************************************************************************/
+wiced_bool_t sim_controller_shm_inject_rx(uint16_t conn_handle, uint16_t psn,
+                                          uint8_t packet_status, uint16_t sdu_len);
+#endif
+
+#endif // SIM_CONTROLLER_H_
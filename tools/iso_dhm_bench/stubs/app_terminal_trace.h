@@ -0,0 +1,15 @@
+/*
+ * $ Copyright YEAR Cypress Semiconductor $
+ */
+/*
+ * @file app_terminal_trace.h
+ *
+ * @brief Host stand-in for the application terminal trace redirection.
+ *        Keeps WICED_BT_TRACE compiled out in the benchmark build.
+ */
+#ifndef APP_TERMINAL_TRACE_H
+#define APP_TERMINAL_TRACE_H
+
+#include "wiced_bt_trace.h"
+
+#endif
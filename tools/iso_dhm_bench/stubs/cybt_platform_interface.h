@@ -0,0 +1,15 @@
+/*
+ * $ Copyright YEAR Cypress Semiconductor $
+ */
+/*
+ * @file cybt_platform_interface.h
+ *
+ * @brief Host stand-in for the platform section macros.
+ */
+#ifndef CYBT_PLATFORM_INTERFACE_H_
+#define CYBT_PLATFORM_INTERFACE_H_
+
+#define CY_SECTION_RAMFUNC_BEGIN
+#define CY_SECTION_RAMFUNC_END
+
+#endif // CYBT_PLATFORM_INTERFACE_H_
@@ -0,0 +1,24 @@
+/*
+ * $ Copyright YEAR Cypress Semiconductor $
+ */
+/*
+ * @file wiced_bt_cfg.h
+ *
+ * @brief Host stand-in for the ISOC part of the btstack configuration.
+ */
+#ifndef WICED_BT_CFG_H_
+#define WICED_BT_CFG_H_
+
+#include "wiced_bt_types.h"
+
+typedef struct
+{
+    uint16_t max_sdu_size;
+    uint8_t  channel_count;
+    uint8_t  max_cis_conn;
+    uint8_t  max_cig_count;
+    uint8_t  max_buffers_per_cis;
+    uint8_t  max_big_count;
+} wiced_bt_cfg_isoc_t;
+
+#endif // WICED_BT_CFG_H_
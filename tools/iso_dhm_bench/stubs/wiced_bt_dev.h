@@ -0,0 +1,29 @@
+/*
+ * $ Copyright YEAR Cypress Semiconductor $
+ */
+/*
+ * @file wiced_bt_dev.h
+ *
+ * @brief Host stand-in for the btstack HCI command API used by the ISO data
+ *        handler. The implementation lives in sim_controller.c.
+ */
+#ifndef WICED_BT_DEV_H_
+#define WICED_BT_DEV_H_
+
+#include "wiced_bt_types.h"
+
+typedef struct
+{
+    uint16_t opcode;
+    uint16_t param_len;
+    uint8_t  *p_param_buf;
+} wiced_bt_dev_vendor_specific_command_complete_params_t;
+
+typedef void (wiced_bt_dev_vendor_specific_command_complete_cback_t)(
+    wiced_bt_dev_vendor_specific_command_complete_params_t *p_command_complete_params);
+
+wiced_result_t wiced_bt_dev_vendor_specific_command(uint16_t opcode,
+    uint8_t param_len, uint8_t *p_param_buf,
+    wiced_bt_dev_vendor_specific_command_complete_cback_t *p_cback);
+
+#endif // WICED_BT_DEV_H_
@@ -0,0 +1,24 @@
+/*
+ * $ Copyright YEAR Cypress Semiconductor $
+ */
+/*
+ * @file wiced_bt_isoc.h
+ *
+ * @brief Host stand-in for the ISOC data path API used by the ISO data
+ *        handler. The implementation lives in sim_controller.c.
+ */
+#ifndef WICED_BT_ISOC_H_
+#define WICED_BT_ISOC_H_
+
+#include "wiced_bt_types.h"
+
+typedef void (*wiced_ble_isoc_rx_data_cb_t)(uint8_t *p_data, uint32_t length);
+typedef wiced_bool_t (*wiced_ble_isoc_num_complete_cb_t)(uint8_t *p_buf);
+
+void wiced_ble_isoc_register_data_cb(wiced_ble_isoc_rx_data_cb_t rx_cb,
+                                     wiced_ble_isoc_num_complete_cb_t num_complete_cb);
+wiced_bool_t wiced_ble_isoc_write_data_to_lower(uint8_t *p_data, uint32_t len);
+wiced_bool_t wiced_ble_isoc_is_cis_connected_with_conn_hdl(uint16_t conn_hdl);
+wiced_bool_t wiced_ble_isoc_is_bis_created(uint16_t conn_hdl);
+
+#endif // WICED_BT_ISOC_H_
@@ -0,0 +1,17 @@
+/*
+ * $ Copyright YEAR Cypress Semiconductor $
+ */
+/*
+ * @file wiced_bt_trace.h
+ *
+ * @brief Host stand-in for btstack tracing. Traces are compiled out so they
+ *        do not distort the measurements.
+ */
+#ifndef WICED_BT_TRACE_H_
+#define WICED_BT_TRACE_H_
+
+#define WICED_BT_TRACE(...)
+#define WICED_BT_TRACE_CRIT(...)
+#define WICED_BT_TRACE_ARRAY(...)
+
+#endif // WICED_BT_TRACE_H_
@@ -0,0 +1,60 @@
+/*
+ * $ Copyright YEAR Cypress Semiconductor $
+ */
+/*
+ * @file wiced_bt_types.h
+ *
+ * @brief Host stand-in for the btstack base types used by the ISO data
+ *        handler. Only what the data handler needs is provided.
+ */
+#ifndef WICED_BT_TYPES_H_
+#define WICED_BT_TYPES_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef uint8_t  wiced_bool_t;
+typedef uint32_t wiced_result_t;
+
+#define WICED_TRUE              1
+#define WICED_FALSE             0
+#ifndef TRUE
+#define TRUE                    1
+#define FALSE                   0
+#endif
+
+#define WICED_SUCCESS           0
+#define WICED_BT_SUCCESS        0
+#define WICED_BT_PENDING        0x8001
+#define WICED_BT_ERROR          0x8005
+#define WICED_BT_NO_RESOURCES   0x8006
+
+#define CY_UNUSED_PARAMETER(x)  (void)(x)
+
+#define UINT8_TO_STREAM(p, u8)   {*(p)++ = (uint8_t)(u8);}
+#define UINT16_TO_STREAM(p, u16) {*(p)++ = (uint8_t)(u16); \
+                                  *(p)++ = (uint8_t)((u16) >> 8);}
+#define UINT24_TO_STREAM(p, u24) {*(p)++ = (uint8_t)(u24); \
+                                  *(p)++ = (uint8_t)((u24) >> 8); \
+                                  *(p)++ = (uint8_t)((u24) >> 16);}
+#define UINT32_TO_STREAM(p, u32) {*(p)++ = (uint8_t)(u32); \
+                                  *(p)++ = (uint8_t)((u32) >> 8); \
+                                  *(p)++ = (uint8_t)((u32) >> 16); \
+                                  *(p)++ = (uint8_t)((u32) >> 24);}
+#define UINT32_TO_BE_STREAM(p, u32) {*(p)++ = (uint8_t)((u32) >> 24); \
+                                     *(p)++ = (uint8_t)((u32) >> 16); \
+                                     *(p)++ = (uint8_t)((u32) >> 8); \
+                                     *(p)++ = (uint8_t)(u32);}
+
+#define STREAM_TO_UINT8(u8, p)   {u8 = (uint8_t)(*(p)); (p) += 1;}
+#define STREAM_TO_UINT16(u16, p) {u16 = ((uint16_t)(*(p)) + \
+                                  (((uint16_t)(*((p) + 1))) << 8)); (p) += 2;}
+#define STREAM_TO_UINT24(u32, p) {u32 = (((uint32_t)(*(p))) + \
+                                  ((((uint32_t)(*((p) + 1)))) << 8) + \
+                                  ((((uint32_t)(*((p) + 2)))) << 16)); (p) += 3;}
+#define STREAM_TO_UINT32(u32, p) {u32 = (((uint32_t)(*(p))) + \
+                                  ((((uint32_t)(*((p) + 1)))) << 8) + \
+                                  ((((uint32_t)(*((p) + 2)))) << 16) + \
+                                  ((((uint32_t)(*((p) + 3)))) << 24)); (p) += 4;}
+
+#endif // WICED_BT_TYPES_H_
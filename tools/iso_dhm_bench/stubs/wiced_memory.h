@@ -0,0 +1,22 @@
+/*
+ * $ Copyright YEAR Cypress Semiconductor $
+ */
+/*
+ * @file wiced_memory.h
+ *
+ * @brief Host stand-in for the btstack buffer pool API. The implementation
+ *        lives in sim_controller.c and counts every pool operation.
+ */
+#ifndef WICED_MEMORY_H_
+#define WICED_MEMORY_H_
+
+#include "wiced_bt_types.h"
+
+typedef struct wiced_bt_buffer wiced_bt_buffer_t;
+
+wiced_bt_buffer_t *wiced_bt_create_pool(const char *name, uint32_t buffer_size,
+                                        uint32_t buffer_cnt, void *p_heap);
+void *wiced_bt_get_buffer_from_pool(wiced_bt_buffer_t *p_pool);
+void wiced_bt_free_buffer(void *p_buf);
+
+#endif // WICED_MEMORY_H_
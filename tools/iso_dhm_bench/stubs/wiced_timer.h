@@ -0,0 +1,17 @@
+/*
+ * $ Copyright YEAR Cypress Semiconductor $
+ */
+/*
+ * @file wiced_timer.h
+ *
+ * @brief Host stand-in for the btstack system clock. The implementation
+ *        lives in sim_controller.c.
+ */
+#ifndef WICED_TIMER_H_
+#define WICED_TIMER_H_
+
+#include "wiced_bt_types.h"
+
+uint64_t clock_SystemTimeMicroseconds64(void);
+
+#endif // WICED_TIMER_H_